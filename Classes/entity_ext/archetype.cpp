@@ -0,0 +1,238 @@
+/*
+
+the archetype layout keeps the entities with the same components together
+
+Author:  yukun tan (codecraft@163.com)
+
+(C) Copyright tanyukun 2015. Permission to copy, use, modify, sell and
+distribute this software is granted provided this copyright notice appears
+in all copies. This software is provided "as is" without express or implied
+warranty, and with no claim as to its suitability for any purpose.
+
+*/
+#include "archetype.h"
+
+namespace ECS {
+	static std::size_t alignUp(std::size_t n, std::size_t align) {
+		return (n + align - 1) / align * align;
+	}
+
+	Archetype::Archetype(const ComponentMask &mask, const std::vector<ComponentInfo> &infos)
+		: m_mask(mask) {
+		std::size_t row_bytes = 0;
+		for (std::size_t i = 0; i < infos.size(); i++) {
+			if (!mask.test(i))
+				continue;
+			assert(infos[i].size > 0 && infos[i].align <= alignof(std::max_align_t));
+			if (m_column_of.size() <= i)
+				m_column_of.resize(i + 1, -1);
+			m_column_of[i] = int32_t(m_columns.size());
+			Column column = { i, infos[i].size, 0, &infos[i] };
+			m_columns.push_back(column);
+			row_bytes += infos[i].size;
+		}
+
+		if (m_columns.empty())
+			return;
+
+		// as many rows as fit in a chunk, at least one for the big components
+		m_chunk_capacity = std::max<std::size_t>(1, CHUNK_SIZE / row_bytes);
+		for (;;) {
+			std::size_t offset = 0;
+			for (auto &column : m_columns) {
+				offset = alignUp(offset, column.info->align);
+				column.offset = offset;
+				offset += column.size * m_chunk_capacity;
+			}
+			m_chunk_bytes = offset;
+			if (m_chunk_bytes <= CHUNK_SIZE || m_chunk_capacity == 1)
+				break;
+			--m_chunk_capacity;
+		}
+	}
+
+	Archetype::~Archetype() {
+		for (uint32_t row = 0; row < m_entities.size(); row++)
+			destroyRow(row);
+		for (auto chunk : m_chunks)
+			::operator delete(chunk);
+	}
+
+	uint32_t Archetype::push(uint32_t index) {
+		uint32_t row = uint32_t(m_entities.size());
+		if (!m_columns.empty() && row / m_chunk_capacity >= m_chunks.size())
+			m_chunks.push_back(static_cast<char*>(::operator new(m_chunk_bytes)));
+		m_entities.push_back(index);
+		return row;
+	}
+
+	uint32_t Archetype::erase(uint32_t row) {
+		uint32_t last = uint32_t(m_entities.size() - 1);
+		uint32_t moved = INVALID;
+		if (row != last) {
+			for (auto &column : m_columns)
+				column.info->relocate(get(column.family, row), get(column.family, last));
+			moved = m_entities[row] = m_entities[last];
+		}
+		m_entities.pop_back();
+
+		// give back the chunk emptied
+		if (!m_columns.empty() && m_chunks.size() > (m_entities.size() + m_chunk_capacity - 1) / m_chunk_capacity) {
+			::operator delete(m_chunks.back());
+			m_chunks.pop_back();
+		}
+		return moved;
+	}
+
+	void Archetype::destroyRow(uint32_t row) {
+		for (auto &column : m_columns)
+			column.info->destroy(get(column.family, row));
+	}
+
+	ArchetypeStorage::ArchetypeStorage() {
+		m_infos.reserve(MAX_COMPONENTS);
+	}
+
+	ArchetypeStorage::~ArchetypeStorage() {
+		for (auto archetype : m_archetypes)
+			delete archetype;
+	}
+
+	void ArchetypeStorage::registerComponent(BaseComponent::Family family, const ComponentInfo &info) {
+		// the archetypes point into the infos, never reallocate it
+		assert(family < MAX_COMPONENTS);
+		if (m_infos.size() <= family)
+			m_infos.resize(family + 1);
+		m_infos[family] = info;
+	}
+
+	void ArchetypeStorage::accommodate(std::size_t n) {
+		if (m_locations.size() < n)
+			m_locations.resize(n);
+	}
+
+	void ArchetypeStorage::reserve(std::size_t n) {
+		m_locations.reserve(n);
+	}
+
+	void *ArchetypeStorage::add(BaseComponent::Family family, uint32_t index) {
+		bool constructed = false;
+		void *component = claim(family, index, constructed);
+		if (!constructed)
+			m_infos[family].construct(component);
+		return component;
+	}
+
+	void *ArchetypeStorage::claim(BaseComponent::Family family, uint32_t index, bool &constructed) {
+		Location &location = m_locations[index];
+		Archetype *source = location.archetype;
+		constructed = source && source->hasColumn(family);
+		if (constructed)
+			return source->get(family, location.row);
+
+		Archetype *dest = nullptr;
+		if (source) {
+			auto it = source->m_add_edges.find(family);
+			if (it != source->m_add_edges.end()) {
+				dest = it->second;
+			}
+			else {
+				dest = archetypeFor(ComponentMask(source->mask()).set(family));
+				source->m_add_edges[family] = dest;
+			}
+		}
+		else {
+			dest = archetypeFor(ComponentMask().set(family));
+		}
+
+		uint32_t row = moveTo(index, dest);
+		return dest->get(family, row);
+	}
+
+	void ArchetypeStorage::remove(BaseComponent::Family family, uint32_t index) {
+		Location &location = m_locations[index];
+		Archetype *source = location.archetype;
+		if (!source || !source->hasColumn(family))
+			return;
+
+		m_infos[family].destroy(source->get(family, location.row));
+
+		ComponentMask mask(source->mask());
+		mask.reset(family);
+		if (mask.none()) {
+			uint32_t moved = source->erase(location.row);
+			if (moved != Archetype::INVALID)
+				m_locations[moved].row = location.row;
+			location = Location();
+			return;
+		}
+
+		Archetype *dest = nullptr;
+		auto it = source->m_remove_edges.find(family);
+		if (it != source->m_remove_edges.end()) {
+			dest = it->second;
+		}
+		else {
+			dest = archetypeFor(mask);
+			source->m_remove_edges[family] = dest;
+		}
+		moveTo(index, dest);
+	}
+
+	void ArchetypeStorage::destroy(uint32_t index) {
+		Location &location = m_locations[index];
+		Archetype *source = location.archetype;
+		if (!source)
+			return;
+
+		source->destroyRow(location.row);
+		uint32_t moved = source->erase(location.row);
+		if (moved != Archetype::INVALID)
+			m_locations[moved].row = location.row;
+		location = Location();
+	}
+
+	void ArchetypeStorage::relocate(uint32_t from, uint32_t to) {
+		Location &location = m_locations[from];
+		if (location.archetype)
+			location.archetype->m_entities[location.row] = to;
+		m_locations[to] = location;
+		location = Location();
+	}
+
+	void ArchetypeStorage::shrink(std::size_t n) {
+		if (n < m_locations.size())
+			m_locations.resize(n);
+		m_locations.shrink_to_fit();
+	}
+
+	Archetype *ArchetypeStorage::archetypeFor(const ComponentMask &mask) {
+		auto it = m_lookup.find(mask);
+		if (it != m_lookup.end())
+			return it->second;
+
+		Archetype *archetype = new Archetype(mask, m_infos);
+		m_archetypes.push_back(archetype);
+		m_lookup.insert(std::make_pair(mask, archetype));
+		return archetype;
+	}
+
+	uint32_t ArchetypeStorage::moveTo(uint32_t index, Archetype *dest) {
+		Location &location = m_locations[index];
+		Archetype *source = location.archetype;
+		uint32_t row = dest->push(index);
+		if (source) {
+			// the components not in dest are destroyed by the caller already
+			for (auto &column : source->m_columns) {
+				if (dest->hasColumn(column.family))
+					column.info->relocate(dest->get(column.family, row), source->get(column.family, location.row));
+			}
+			uint32_t moved = source->erase(location.row);
+			if (moved != Archetype::INVALID)
+				m_locations[moved].row = location.row;
+		}
+		location.archetype = dest;
+		location.row = row;
+		return row;
+	}
+}
@@ -0,0 +1,238 @@
+#ifndef _ARCHETYPE_H_
+#define _ARCHETYPE_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <algorithm>
+#include <bitset>
+#include <new>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "component.h"
+#include "../tool/pool.h"
+
+namespace ECS {
+	/**
+	* the type erased operations of a component type, 
+	* for moving the components between the archetypes
+	*/
+	struct ComponentInfo {
+		std::size_t size = 0;
+		std::size_t align = 0;
+		// default construct at dest
+		void(*construct)(void *dest) = nullptr;
+		// move construct at dest, then destroy the source
+		void(*relocate)(void *dest, void *source) = nullptr;
+		void(*destroy)(void *target) = nullptr;
+
+		template <typename T>
+		static ComponentInfo of();
+	};
+
+	/**
+	* all the entities with the same component mask, 
+	* the components are saved in chunks of 16 KB, one column for each component
+	*/
+	class Archetype {
+	public:
+		typedef std::bitset<MAX_COMPONENTS> ComponentMask;
+
+		static const std::size_t CHUNK_SIZE = 16 * 1024;
+		static const uint32_t INVALID = ~0U;
+
+		Archetype(const ComponentMask &mask, const std::vector<ComponentInfo> &infos);
+		~Archetype();
+
+		const ComponentMask &mask() const { return m_mask; }
+
+		// the entity indices, one for each row
+		const std::vector<uint32_t> &entities() const { return m_entities; }
+
+		std::size_t size() const { return m_entities.size(); }
+
+		std::size_t chunkCapacity() const { return m_chunk_capacity; }
+
+		bool hasColumn(BaseComponent::Family family) const {
+			return family < m_column_of.size() && m_column_of[family] >= 0;
+		}
+
+		inline void *get(BaseComponent::Family family, uint32_t row) {
+			const Column &column = m_columns[m_column_of[family]];
+			return m_chunks[row / m_chunk_capacity] + column.offset + (row % m_chunk_capacity) * column.size;
+		}
+
+		std::size_t chunks() const { return m_chunks.size(); }
+
+		// the first element of the component column in the chunk
+		inline void *column(BaseComponent::Family family, std::size_t chunk) {
+			return m_chunks[chunk] + m_columns[m_column_of[family]].offset;
+		}
+
+		// add a row for the entity, the components are not constructed
+		uint32_t push(uint32_t index);
+
+		// the components of the row must be destroyed or moved out already,
+		// the last row is moved into the hole, @return the entity moved or INVALID
+		uint32_t erase(uint32_t row);
+
+		// destroy all the components of the row
+		void destroyRow(uint32_t row);
+
+	private:
+		friend class ArchetypeStorage;
+
+		struct Column {
+			BaseComponent::Family family;
+			std::size_t size;
+			std::size_t offset;
+			const ComponentInfo *info;
+		};
+
+		ComponentMask m_mask;
+		std::vector<Column> m_columns;
+		std::vector<int32_t> m_column_of;
+		std::vector<char*> m_chunks;
+		std::vector<uint32_t> m_entities;
+		std::size_t m_chunk_capacity = 0;
+		std::size_t m_chunk_bytes = 0;
+		// the archetypes reached by adding or removing a component
+		std::unordered_map<BaseComponent::Family, Archetype*> m_add_edges;
+		std::unordered_map<BaseComponent::Family, Archetype*> m_remove_edges;
+	};
+
+	/**
+	* the archetype layout of an EntityManager: 
+	* entities are moved between the archetypes when the components are added or removed
+	*/
+	class ArchetypeStorage {
+	public:
+		typedef std::bitset<MAX_COMPONENTS> ComponentMask;
+
+		ArchetypeStorage();
+		~ArchetypeStorage();
+
+		void registerComponent(BaseComponent::Family family, const ComponentInfo &info);
+
+		// ensure the entity indices less than n can be located
+		void accommodate(std::size_t n);
+
+		void reserve(std::size_t n);
+
+		inline void *get(BaseComponent::Family family, uint32_t index) {
+			const Location &location = m_locations[index];
+			assert(location.archetype && location.archetype->hasColumn(family));
+			return location.archetype->get(family, location.row);
+		}
+
+		// move the entity to the archetype with the component, and construct it
+		void *add(BaseComponent::Family family, uint32_t index);
+
+		// move the entity to the archetype with the component, the storage is left
+		// for the caller to construct, unless constructed is true: it was there already
+		void *claim(BaseComponent::Family family, uint32_t index, bool &constructed);
+
+		// destroy the component, and move the entity to the archetype without it
+		void remove(BaseComponent::Family family, uint32_t index);
+
+		// destroy all the components of the entity
+		void destroy(uint32_t index);
+
+		// the entity from takes the index to, its components stay in place
+		void relocate(uint32_t from, uint32_t to);
+
+		// drop the locations from n on, and release the memory
+		void shrink(std::size_t n);
+
+		const std::vector<Archetype*> &archetypes() const { return m_archetypes; }
+
+	private:
+		struct Location {
+			Archetype *archetype = nullptr;
+			uint32_t row = 0;
+		};
+
+		Archetype *archetypeFor(const ComponentMask &mask);
+
+		// move the components in both archetypes to a new row of dest, then free the old row
+		uint32_t moveTo(uint32_t index, Archetype *dest);
+
+		std::vector<ComponentInfo> m_infos;
+		std::vector<Archetype*> m_archetypes;
+		std::unordered_map<ComponentMask, Archetype*> m_lookup;
+		std::vector<Location> m_locations;
+	};
+
+	/**
+	* the pool of a component type in the archetype layout,
+	* the components are kept by the archetypes
+	*/
+	template <typename T>
+	class ArchetypePool : public BasePool {
+	public:
+		ArchetypePool(ArchetypeStorage *storage, BaseComponent::Family family)
+			: storage_(storage), family_(family) {
+			storage_->registerComponent(family_, ComponentInfo::of<T>());
+		}
+
+		virtual void expand(std::size_t n) override {}
+
+		virtual void reserve(std::size_t n) override {}
+
+		virtual void *get(std::size_t n) override {
+			return storage_->get(family_, uint32_t(n));
+		}
+
+		virtual const void *get(std::size_t n) const override {
+			return storage_->get(family_, uint32_t(n));
+		}
+
+		virtual void *assign(std::size_t n) override {
+			return storage_->add(family_, uint32_t(n));
+		}
+
+		virtual void destroy(std::size_t n) override {
+			storage_->remove(family_, uint32_t(n));
+		}
+
+		virtual void create(std::size_t count) override {}
+
+		// moved by the storage for all the components at once
+		virtual void relocate(std::size_t from, std::size_t to) override {}
+
+	private:
+		ArchetypeStorage *storage_;
+		BaseComponent::Family family_;
+	};
+
+	template <typename T>
+	struct ComponentOperations {
+		static void construct(void *dest) {
+			new (dest) T();
+		}
+
+		static void relocate(void *dest, void *source) {
+			new (dest) T(std::move(*static_cast<T*>(source)));
+			static_cast<T*>(source)->~T();
+		}
+
+		static void destroy(void *target) {
+			static_cast<T*>(target)->~T();
+		}
+	};
+
+	template <typename T>
+	ComponentInfo ComponentInfo::of() {
+		ComponentInfo info;
+		info.size = sizeof(T);
+		info.align = alignof(T);
+		info.construct = &ComponentOperations<T>::construct;
+		info.relocate = &ComponentOperations<T>::relocate;
+		info.destroy = &ComponentOperations<T>::destroy;
+		return info;
+	}
+}
+
+#endif
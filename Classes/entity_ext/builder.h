@@ -42,13 +42,13 @@ namespace ECS {
 			return dest;
 		}
 
-        // extend the prefab existed with the component, component here must not be created
+        // extend the prefab existed with the component, component here must not be created,
+        // it is copied in, or moved in for the rvalues
 		template <typename Component>
-		Entity extendAssign(const char *prefab, Component &com) {
+		Entity extendAssign(const char *prefab, Component &&com) {
 			auto dest = clonePrefab(prefab);
 			if (dest.valid()) {
-				auto com_self = dest.assignComponent<Component>().get();
-				*com_self = com;
+				assign(dest, std::forward<Component>(com));
 				afterCreated(dest);
 			}
 			return dest;
@@ -56,10 +56,10 @@ namespace ECS {
 
         // extend the prefab existed with components, components here must not be created
 		template <typename ...Components>
-		Entity extendAssigns(const char *prefab, Components & ...coms) {
+		Entity extendAssigns(const char *prefab, Components && ...coms) {
 			auto dest = clonePrefab(prefab);
 			if (dest.valid()) {
-				assign(dest, coms ...);
+				assign(dest, std::forward<Components>(coms) ...);
 				afterCreated(dest);
 			}
 			return dest;
@@ -79,15 +79,14 @@ namespace ECS {
 		}
 
 		template <typename Component>
-		void assign(Entity dest, Component &com) {
-			auto com_self = dest.assignComponent<Component>().get();
-			*com_self = com;
+		void assign(Entity dest, Component &&com) {
+			dest.emplaceComponent<typename std::decay<Component>::type>(std::forward<Component>(com));
 		}
 
-		template <typename C1, typename ... C_N>
-		void assign(Entity dest, C1 &c1, C_N & ... cn) {
-			assign(dest, c1);
-			assign(dest, cn ...);
+		template <typename C1, typename C2, typename ... C_N>
+		void assign(Entity dest, C1 &&c1, C2 &&c2, C_N && ... cn) {
+			assign(dest, std::forward<C1>(c1));
+			assign(dest, std::forward<C2>(c2), std::forward<C_N>(cn) ...);
 		}
 
 	protected:
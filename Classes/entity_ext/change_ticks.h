@@ -0,0 +1,83 @@
+#ifndef _CHANGE_TICKS_H_
+#define _CHANGE_TICKS_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <vector>
+
+namespace ECS {
+	/**
+	* the tick of the last change of a component, for each entity. the latest tick of
+	* each block of 64 entities is kept too, so the changes since a tick are found
+	* by the blocks, without visiting all the entities
+	*/
+	class ChangeTicks {
+	public:
+		static const size_t BLOCK_SIZE = 64;
+		static const size_t END = ~size_t(0);
+
+		// the ticks only grow
+		void touch(uint32_t index, uint32_t tick) {
+			if (m_ticks.size() <= index) {
+				m_ticks.resize(index + 1, 0);
+				m_blocks.resize(index / BLOCK_SIZE + 1, 0);
+			}
+			m_ticks[index] = tick;
+			m_blocks[index / BLOCK_SIZE] = tick;
+		}
+
+		uint32_t tick(uint32_t index) const {
+			return index < m_ticks.size() ? m_ticks[index] : 0;
+		}
+
+		// the first index from begin changed at the tick since or later, END if none
+		size_t next(size_t begin, uint32_t since) const {
+			for (size_t block = begin / BLOCK_SIZE; block < m_blocks.size(); block++) {
+				if (m_blocks[block] < since)
+					continue;
+				size_t end = std::min(m_ticks.size(), (block + 1) * BLOCK_SIZE);
+				for (size_t index = std::max(begin, block * BLOCK_SIZE); index < end; index++) {
+					if (m_ticks[index] >= since)
+						return index;
+				}
+			}
+			return END;
+		}
+
+		// the component of from moved to the index to
+		void relocate(uint32_t from, uint32_t to) {
+			uint32_t tick = this->tick(from);
+			if (m_ticks.size() <= to) {
+				if (!tick)
+					return;
+				m_ticks.resize(to + 1, 0);
+				m_blocks.resize(to / BLOCK_SIZE + 1, 0);
+			}
+			m_ticks[to] = tick;
+			m_blocks[to / BLOCK_SIZE] = std::max(m_blocks[to / BLOCK_SIZE], tick);
+			if (from < m_ticks.size())
+				m_ticks[from] = 0;
+		}
+
+		void shrink(size_t n) {
+			if (n < m_ticks.size()) {
+				m_ticks.resize(n);
+				m_blocks.resize((n + BLOCK_SIZE - 1) / BLOCK_SIZE);
+			}
+			m_ticks.shrink_to_fit();
+			m_blocks.shrink_to_fit();
+		}
+
+		void clear() {
+			m_ticks.clear();
+			m_blocks.clear();
+		}
+
+	private:
+		std::vector<uint32_t> m_ticks;
+		std::vector<uint32_t> m_blocks;
+	};
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+
+the command buffer defers the structural changes made while iterating
+
+Author:  yukun tan (codecraft@163.com)
+
+(C) Copyright tanyukun 2015. Permission to copy, use, modify, sell and
+distribute this software is granted provided this copyright notice appears
+in all copies. This software is provided "as is" without express or implied
+warranty, and with no claim as to its suitability for any purpose.
+
+*/
+#include "command_buffer.h"
+#include "entity.hpp"
+#include "event.h"
+#include "event_internal.h"
+#include <algorithm>
+#include <cassert>
+
+namespace ECS {
+	const uint32_t EntityCommandBuffer::PENDING;
+	const size_t EntityCommandBuffer::BLOCK_SIZE;
+
+	EntityCommandBuffer::~EntityCommandBuffer() {
+		clear();
+	}
+
+	Entity::ID EntityCommandBuffer::create() {
+		return Entity::ID(m_created++, PENDING);
+	}
+
+	void EntityCommandBuffer::destroy(Entity::ID id) {
+		Command command = { OP_DESTROY, 0, id, nullptr, nullptr };
+		m_commands.push_back(command);
+	}
+
+	void EntityCommandBuffer::playback(EntityManager &manager) {
+		std::vector<Entity> created;
+		if (m_created)
+			manager.createMany(m_created, created);
+		for (auto &command : m_commands)
+			command.id = resolve(command.id, created);
+
+		// family by family, the entities in order, the commands on the same component
+		// of an entity keep their order
+		std::stable_sort(m_commands.begin(), m_commands.end(), [](const Command &a, const Command &b) {
+			if ((a.op == OP_DESTROY) != (b.op == OP_DESTROY))
+				return b.op == OP_DESTROY;
+			if (a.family != b.family)
+				return a.family < b.family;
+			return a.id.index() < b.id.index();
+		});
+
+		// the destroys are last, in the order of the indices, the repeated ones side by side
+		std::vector<Entity::ID> destroyed;
+		for (auto &command : m_commands) {
+			if (command.op == OP_DESTROY && manager.valid(command.id) && (destroyed.empty() || destroyed.back() != command.id))
+				destroyed.push_back(command.id);
+		}
+
+		// the components and the entities are still there for the receivers
+		EventSystem *event_system = manager.getEventSystem();
+		if (event_system) {
+			for (auto &command : m_commands) {
+				if (command.op == OP_REMOVE && manager.valid(command.id) && manager.componentMask(command.id).test(command.family))
+					event_system->send(manager.get(command.id), *BeforeRemoveComponent::getInstance());
+			}
+			if (!destroyed.empty()) {
+				BeforeRemoveEntities evt(destroyed.data(), destroyed.size());
+				event_system->send(manager.get(Entity::INVALID), evt);
+			}
+			manager.setEventSystem(nullptr);
+		}
+
+		for (auto &command : m_commands) {
+			if (command.op == OP_DESTROY || !manager.valid(command.id))
+				continue;
+			if (command.op == OP_ASSIGN)
+				command.operations->assign(manager, command.id, command.payload);
+			else
+				command.operations->remove(manager, command.id);
+		}
+		manager.destroyMany(destroyed);
+
+		if (event_system) {
+			manager.setEventSystem(event_system);
+			for (auto &command : m_commands) {
+				if (command.op == OP_ASSIGN && manager.valid(command.id) && manager.componentMask(command.id).test(command.family))
+					event_system->send(manager.get(command.id), *OnAddedComponent::getInstance());
+			}
+		}
+		clear();
+	}
+
+	void EntityCommandBuffer::clear() {
+		for (auto &command : m_commands) {
+			if (command.payload)
+				command.operations->destroy(command.payload);
+		}
+		m_commands.clear();
+		m_created = 0;
+		m_block = 0;
+		m_offset = 0;
+		m_large.clear();
+	}
+
+	void *EntityCommandBuffer::allocate(size_t size, size_t align) {
+		if (size + align > BLOCK_SIZE) {
+			m_large.push_back(std::unique_ptr<char[]>(new char[size + align]));
+			size_t address = reinterpret_cast<size_t>(m_large.back().get());
+			return m_large.back().get() + (align - address % align) % align;
+		}
+		for (;;) {
+			if (m_block == m_blocks.size())
+				m_blocks.push_back(std::unique_ptr<char[]>(new char[BLOCK_SIZE]));
+			size_t address = reinterpret_cast<size_t>(m_blocks[m_block].get()) + m_offset;
+			size_t offset = m_offset + (align - address % align) % align;
+			if (offset + size <= BLOCK_SIZE) {
+				m_offset = offset + size;
+				return m_blocks[m_block].get() + offset;
+			}
+			m_block++;
+			m_offset = 0;
+		}
+	}
+
+	Entity::ID EntityCommandBuffer::resolve(Entity::ID id, const std::vector<Entity> &created) const {
+		if (id.version() != PENDING)
+			return id;
+		assert(id.index() < created.size());
+		return created[id.index()].id();
+	}
+}
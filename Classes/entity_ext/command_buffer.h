@@ -0,0 +1,129 @@
+#ifndef _COMMAND_BUFFER_H_
+#define _COMMAND_BUFFER_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "entity.h"
+
+namespace ECS {
+	/**
+	* the structural changes recorded while the entities are iterated, applied later
+	* at once by playback: the entities created first, then the components added and
+	* removed family by family, in the order recorded for each family, then the
+	* entities destroyed in one batch.
+	* the components added are moved into an arena of the buffer until the playback.
+	* a buffer is recorded by one thread at a time
+	*/
+	class EntityCommandBuffer {
+	public:
+		EntityCommandBuffer() = default;
+		~EntityCommandBuffer();
+
+		EntityCommandBuffer(const EntityCommandBuffer &) = delete;
+		EntityCommandBuffer &operator = (const EntityCommandBuffer &) = delete;
+
+		// an id standing for the entity until it is created by the playback,
+		// it is only valid for the commands of this buffer
+		Entity::ID create();
+
+		void destroy(Entity::ID id);
+
+		template <typename ComponentType, typename ... Args>
+		void assignComponent(Entity::ID id, Args && ... args);
+
+		template <typename ComponentType>
+		void removeComponent(Entity::ID id);
+
+		size_t size() const { return m_commands.size() + m_created; }
+		bool empty() const { return size() == 0; }
+
+		// apply the commands, then empty the buffer. the events before a removal are
+		// sent before any change, OnAddedComponent once all of them are applied.
+		// the commands on the entities no more valid are dropped
+		void playback(EntityManager &manager);
+
+		// drop the commands not applied
+		void clear();
+
+	private:
+		enum Op {
+			OP_ASSIGN,
+			OP_REMOVE,
+			OP_DESTROY
+		};
+
+		// the type of a component, erased
+		struct Operations {
+			void (*assign)(EntityManager &manager, Entity::ID id, void *payload);
+			void (*remove)(EntityManager &manager, Entity::ID id);
+			void (*destroy)(void *payload);
+		};
+
+		template <typename ComponentType>
+		struct TypedOperations {
+			static void assign(EntityManager &manager, Entity::ID id, void *payload) {
+				manager.assignComponentFrom<ComponentType>(id, std::move(*static_cast<ComponentType*>(payload)));
+			}
+			static void remove(EntityManager &manager, Entity::ID id) {
+				if (manager.hasComponent<ComponentType>(id))
+					manager.removeComponent<ComponentType>(id);
+			}
+			static void destroy(void *payload) {
+				static_cast<ComponentType*>(payload)->~ComponentType();
+			}
+			static const Operations *get() {
+				static const Operations operations = { &assign, &remove, &destroy };
+				return &operations;
+			}
+		};
+
+		struct Command {
+			Op op;
+			BaseComponent::Family family;
+			Entity::ID id;
+			const Operations *operations;
+			void *payload;
+		};
+
+		// the version of the ids standing for the entities to create
+		static const uint32_t PENDING = ~0U;
+		static const size_t BLOCK_SIZE = 4096;
+
+		// bump allocation, the blocks are kept for the next recording
+		void *allocate(size_t size, size_t align);
+
+		Entity::ID resolve(Entity::ID id, const std::vector<Entity> &created) const;
+
+		std::vector<Command> m_commands;
+		uint32_t m_created = 0;
+
+		std::vector<std::unique_ptr<char[]>> m_blocks;
+		size_t m_block = 0;
+		size_t m_offset = 0;
+		// the payloads larger than a block
+		std::vector<std::unique_ptr<char[]>> m_large;
+	};
+
+	template <typename ComponentType, typename ... Args>
+	void EntityCommandBuffer::assignComponent(Entity::ID id, Args && ... args) {
+		typedef typename std::remove_const<ComponentType>::type Type;
+		void *payload = allocate(sizeof(Type), alignof(Type));
+		new (payload) Type(std::forward<Args>(args) ...);
+		Command command = { OP_ASSIGN, Component<Type>::family(), id, TypedOperations<Type>::get(), payload };
+		m_commands.push_back(command);
+	}
+
+	template <typename ComponentType>
+	void EntityCommandBuffer::removeComponent(Entity::ID id) {
+		typedef typename std::remove_const<ComponentType>::type Type;
+		Command command = { OP_REMOVE, Component<Type>::family(), id, TypedOperations<Type>::get(), nullptr };
+		m_commands.push_back(command);
+	}
+}
+
+#endif
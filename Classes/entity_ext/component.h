@@ -2,8 +2,11 @@
 #define _COMPONENT_H_
 
 #include <cstddef>
+#include <type_traits>
 
 namespace ECS {
+	static const size_t MAX_COMPONENTS = 256;
+
 	/**
 	* the base component :
     * for generating family
@@ -12,6 +15,16 @@ namespace ECS {
 	public:
 		typedef size_t Family;
 
+		enum Storage
+		{
+			// a slot for every entity, indexed directly
+			STORAGE_DENSE,
+			// packed arrays, for the components only a few entities have
+			STORAGE_SPARSE,
+			// only the mask bit, for the marker components
+			STORAGE_TAG
+		};
+
 	public:
 		virtual ~BaseComponent() {}
 
@@ -29,6 +42,44 @@ namespace ECS {
 		static Family family = s_family_counter++;
 		return family;
 	}
+
+	/**
+	* the storage of a component type, dense by default,
+	* use COMPONENT_STORAGE to change it
+	*/
+	template <typename ComponentType>
+	struct ComponentStorage {
+		static const BaseComponent::Storage value = BaseComponent::STORAGE_DENSE;
+	};
+
+	template <typename ComponentType>
+	struct IsTagComponent : std::integral_constant<bool,
+		ComponentStorage<typename std::remove_const<ComponentType>::type>::value == BaseComponent::STORAGE_TAG> {
+		// all the entities share the instance of a tag, it must have no data to share
+		static_assert(ComponentStorage<typename std::remove_const<ComponentType>::type>::value != BaseComponent::STORAGE_TAG ||
+			std::is_empty<ComponentType>::value, "a tag component must be an empty type");
+	};
+
+	/**
+	* the instance shared by all the entities with the tag,
+	* tags hold no data, never write it
+	*/
+	template <typename ComponentType>
+	struct TagInstance {
+		static ComponentType instance;
+	};
+
+	template <typename ComponentType>
+	ComponentType TagInstance<ComponentType>::instance;
 }
 
+// declare the storage of a component type, use it out of any namespace
+#define COMPONENT_STORAGE(ComponentType, StorageKind) \
+	namespace ECS { \
+		template <> \
+		struct ComponentStorage<ComponentType> { \
+			static const BaseComponent::Storage value = BaseComponent::StorageKind; \
+		}; \
+	}
+
 #endif
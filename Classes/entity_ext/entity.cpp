@@ -32,8 +32,10 @@ namespace ECS {
 		return m_manager->componentMask(m_id);
 	}
 
-	EntityManager::EntityManager()
-		: m_event_system(nullptr) {
+	EntityManager::EntityManager(Layout layout)
+		: m_family_bitmaps(MAX_COMPONENTS), m_change_ticks(MAX_COMPONENTS), m_event_system(nullptr) {
+		if (layout == LAYOUT_ARCHETYPE)
+			m_archetypes = std::unique_ptr<ArchetypeStorage>(new ArchetypeStorage());
 	}
 
 	EntityManager::~EntityManager() {
@@ -47,14 +49,29 @@ namespace ECS {
 		m_event_system = event_system;
 	}
 
+	void EntityManager::setThreadPool(ThreadPool *thread_pool)
+	{
+		m_thread_pool = thread_pool;
+	}
+
+	void EntityManager::reserve(size_t count)
+	{
+		m_entity_component_mask.reserve(count);
+		m_entity_version.reserve(count);
+		m_free_list.reserve(count);
+		if (m_archetypes)
+			m_archetypes->reserve(count);
+	}
+
 	Entity EntityManager::create()
 	{
+		assert(!m_locked);
 		uint32_t index, version;
 		if (m_free_list.empty())
 		{
 			index = m_index_counter++;
 			accommodateEntity(index);
-			version = m_entity_version[index] = 1;
+			version = m_entity_version[index] = m_version_floor;
 		}
 		else
 		{
@@ -62,9 +79,37 @@ namespace ECS {
 			m_free_list.pop_back();
 			version = m_entity_version[index];
 		}
+		m_alive.set(index);
 		return Entity(this, Entity::ID(index, version));
 	}
 
+	void EntityManager::createMany(size_t count, std::vector<Entity> &out)
+	{
+		assert(!m_locked);
+		out.reserve(out.size() + count);
+		size_t reused = std::min(count, m_free_list.size());
+		for (size_t i = 0; i < reused; i++)
+		{
+			uint32_t index = m_free_list.back();
+			m_free_list.pop_back();
+			m_alive.set(index);
+			out.push_back(Entity(this, Entity::ID(index, m_entity_version[index])));
+		}
+
+		size_t fresh = count - reused;
+		if (fresh == 0)
+			return;
+		uint32_t first = m_index_counter;
+		m_index_counter += uint32_t(fresh);
+		accommodateEntity(m_index_counter - 1);
+		for (uint32_t index = first; index < m_index_counter; index++)
+		{
+			m_entity_version[index] = m_version_floor;
+			m_alive.set(index);
+			out.push_back(Entity(this, Entity::ID(index, m_version_floor)));
+		}
+	}
+
 	void EntityManager::destroy(Entity::ID id)
 	{
 		m_event_system->send(get(id), *BeforeRemoveEntity::getInstance());
@@ -73,20 +118,228 @@ namespace ECS {
 	}
     
     void EntityManager::destroyNoNotify(Entity::ID id) {
+        assert(!m_locked);
         uint32_t index = id.index();
         auto mask = m_entity_component_mask[id.index()];
-        for (size_t i = 0; i < m_component_pools.size(); i++)
+        if (m_archetypes)
         {
-            BasePool *pool = m_component_pools[i];
-            if (pool && mask.test(i))
-                pool->destroy(index);
+            // all the components leave the archetype at once
+            m_archetypes->destroy(index);
         }
+        else
+        {
+            for (size_t i = 0; i < m_component_pools.size(); i++)
+            {
+                BasePool *pool = m_component_pools[i];
+                if (pool && mask.test(i))
+                    pool->destroy(index);
+            }
+        }
+        for (auto &group : m_groups)
+        {
+            if (group->contains(index))
+                group->erase(index);
+        }
+        clearFamilies(index, mask);
         m_entity_component_mask[index].reset();
+        m_alive.reset(index);
         m_entity_version[index]++;
         m_free_list.push_back(index);
     }
     
+    void EntityManager::destroyMany(const Entity::ID *ids, size_t count) {
+        assert(!m_locked);
+        // the receivers only see the entities destroyed, each one once
+        std::vector<Entity::ID> destroyed;
+        destroyed.reserve(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            if (valid(ids[i]))
+                destroyed.push_back(ids[i]);
+        }
+        std::sort(destroyed.begin(), destroyed.end());
+        destroyed.erase(std::unique(destroyed.begin(), destroyed.end()), destroyed.end());
+        if (m_event_system && !destroyed.empty())
+        {
+            BeforeRemoveEntities evt(destroyed.data(), destroyed.size());
+            m_event_system->send(get(Entity::INVALID), evt);
+        }
+
+        std::vector<uint32_t> indices;
+        indices.reserve(destroyed.size());
+        ComponentMask mask;
+        for (Entity::ID id : destroyed)
+        {
+            // a receiver may have destroyed some of them already
+            if (!valid(id))
+                continue;
+            uint32_t index = id.index();
+            m_entity_version[index]++;
+            mask |= m_entity_component_mask[index];
+            indices.push_back(index);
+        }
+
+        if (m_archetypes)
+        {
+            for (uint32_t index : indices)
+                m_archetypes->destroy(index);
+        }
+        else
+        {
+            // one pool after another, only the families some of them have
+            for (size_t i = 0; i < m_component_pools.size(); i++)
+            {
+                BasePool *pool = m_component_pools[i];
+                if (!pool || !mask.test(i))
+                    continue;
+                for (uint32_t index : indices)
+                {
+                    if (m_entity_component_mask[index].test(i))
+                        pool->destroy(index);
+                }
+            }
+        }
+
+        for (auto &group : m_groups)
+        {
+            for (uint32_t index : indices)
+            {
+                if (group->contains(index))
+                    group->erase(index);
+            }
+        }
+        for (size_t i = 0; i < MAX_COMPONENTS; i++)
+        {
+            if (!mask.test(i))
+                continue;
+            for (uint32_t index : indices)
+                m_family_bitmaps[i].reset(index);
+        }
+        for (uint32_t index : indices)
+        {
+            m_entity_component_mask[index].reset();
+            m_alive.reset(index);
+        }
+        m_free_list.insert(m_free_list.end(), indices.begin(), indices.end());
+    }
+
+    void EntityManager::destroyMany(const std::vector<Entity::ID> &ids) {
+        destroyMany(ids.data(), ids.size());
+    }
+
+    void EntityManager::compact(RemapCallback remap) {
+        assert(!m_locked);
+        const uint32_t alive = uint32_t(size());
+        std::sort(m_free_list.begin(), m_free_list.end());
+
+        // the orders keep the indices of the entities destroyed until their next sort
+        for (size_t family = 0; family < m_sorted.size(); family++)
+        {
+            if (m_sorted[family])
+                m_sorted[family]->retain(m_family_bitmaps[family]);
+        }
+        std::vector<std::pair<uint32_t, uint32_t>> moves;
+
+        // fill the holes below alive from the top, the free list holds as many holes as
+        // there are entities above alive
+        uint32_t from = uint32_t(capacity());
+        for (uint32_t to : m_free_list)
+        {
+            if (to >= alive)
+                break;
+            do {
+                --from;
+            } while (!m_alive.test(from));
+
+            const ComponentMask mask = m_entity_component_mask[from];
+            if (m_archetypes)
+            {
+                m_archetypes->relocate(from, to);
+            }
+            else
+            {
+                for (size_t i = 0; i < m_component_pools.size(); i++)
+                {
+                    BasePool *pool = m_component_pools[i];
+                    if (pool && mask.test(i))
+                        pool->relocate(from, to);
+                }
+            }
+            for (auto &group : m_groups)
+                group->relocate(from, to);
+            for (size_t i = 0; i < MAX_COMPONENTS; i++)
+            {
+                if (mask.test(i))
+                {
+                    m_family_bitmaps[i].set(to);
+                    m_change_ticks[i].relocate(from, to);
+                }
+            }
+            clearFamilies(from, mask);
+            m_alive.reset(from);
+            m_alive.set(to);
+            moves.push_back(std::make_pair(from, to));
+            m_entity_component_mask[to] = mask;
+            m_entity_component_mask[from].reset();
+
+            // the version of the hole is newer than the ids destroyed there
+            if (remap)
+                remap(Entity::ID(from, m_entity_version[from]), Entity::ID(to, m_entity_version[to]));
+        }
+
+        // the ids of the indices released, destroyed or moved, stay below the versions
+        // of the entities made there later
+        for (size_t index = alive; index < m_entity_version.size(); index++)
+            m_version_floor = std::max(m_version_floor, m_entity_version[index] + 1);
+        m_entity_component_mask.resize(alive);
+        m_entity_component_mask.shrink_to_fit();
+        m_entity_version.resize(alive);
+        m_entity_version.shrink_to_fit();
+        m_free_list.clear();
+        m_free_list.shrink_to_fit();
+        m_index_counter = alive;
+        for (BasePool *pool : m_component_pools)
+        {
+            if (pool)
+                pool->shrink(alive);
+        }
+        if (m_archetypes)
+            m_archetypes->shrink(alive);
+        for (auto &group : m_groups)
+            group->shrink(alive);
+        for (auto &bitmap : m_family_bitmaps)
+            bitmap.shrink(alive);
+        for (auto &ticks : m_change_ticks)
+            ticks.shrink(alive);
+        m_alive.shrink(alive);
+        std::sort(moves.begin(), moves.end());
+        for (auto &sorted : m_sorted)
+        {
+            if (sorted)
+            {
+                sorted->remap(moves);
+                sorted->shrink(alive);
+            }
+        }
+    }
+
+    const Group &EntityManager::group(const ComponentMask &mask, const ComponentMask &exclude)
+    {
+        assert(mask.any());
+        const Group *found = groupOf(mask, exclude);
+        if (found)
+            return *found;
+
+        Group *group = new Group(mask, exclude);
+        BitmapScan scan = scanOf(mask, exclude, m_entity_component_mask.size());
+        for (size_t index = scan.next(); index != BitmapScan::END; index = scan.next())
+            group->insert(uint32_t(index));
+        m_groups.push_back(std::unique_ptr<Group>(group));
+        return *group;
+    }
+
 	void EntityManager::clear() {
+		assert(!m_locked);
 		for (auto pool : m_component_pools) {
 			delete pool;
 		}
@@ -95,6 +348,22 @@ namespace ECS {
 		m_free_list.clear();
 		m_entity_component_mask.clear();
 		m_component_pools.clear();
+		m_tag_mask.reset();
 		m_index_counter = 0;
+		for (auto &group : m_groups)
+			group->clear();
+		for (auto &bitmap : m_family_bitmaps)
+			bitmap.clear();
+		for (auto &ticks : m_change_ticks)
+			ticks.clear();
+		m_change_tick = 1;
+		m_alive.clear();
+		for (auto &sorted : m_sorted)
+		{
+			if (sorted)
+				sorted->clear();
+		}
+		if (m_archetypes)
+			m_archetypes = std::unique_ptr<ArchetypeStorage>(new ArchetypeStorage());
 	}
 }
@@ -20,14 +20,27 @@
 #include <functional>
 #include "component.h"
 #include "../tool/pool.h"
+#include "../tool/sparse_pool.h"
+#include "../tool/bitmap.h"
+#include "../tool/span.h"
+#include "../tool/thread_pool.h"
+#include "archetype.h"
+#include "group.h"
+#include "change_ticks.h"
 
 namespace ECS {
-    static const size_t MAX_COMPONENTS = 256;
     class EntityManager;
     class EventSystem;
     template <typename ComponentType, typename ContainerType = EntityManager>
     class ComponentRef;
     
+    // the pool type holding a component type, by its declared storage
+    template <typename ComponentType>
+    struct ComponentPool {
+        typedef typename std::conditional<ComponentStorage<ComponentType>::value == BaseComponent::STORAGE_SPARSE,
+            SparsePool<ComponentType>, Pool<ComponentType>>::type type;
+    };
+    
     class Entity {
     public:
         struct ID
@@ -92,6 +105,14 @@ namespace ECS {
         template <typename ComponentType>
         ComponentRef<ComponentType> assignComponentFrom(const ComponentType &component);
         
+        // move the component in, the overload is for the rvalues only
+        template <typename ComponentType, typename = typename std::enable_if<!std::is_reference<ComponentType>::value>::type>
+        ComponentRef<ComponentType> assignComponentFrom(ComponentType &&component);
+        
+        // construct the component in place with the arguments
+        template <typename ComponentType, typename ... Args>
+        ComponentRef<ComponentType> emplaceComponent(Args && ... args);
+        
         template <typename ComponentType>
         void removeComponent();
         
@@ -101,6 +122,14 @@ namespace ECS {
         template <typename ComponentType>
         ComponentRef<ComponentType, const EntityManager> getComponent() const;
         
+        // the component to change, its change tick is set
+        template <typename ComponentType>
+        ComponentType *getMut();
+        
+        // f(ComponentType &) changes the component, then OnChangedComponent is sent
+        template <typename ComponentType, typename F>
+        void patch(F f);
+        
         template <typename ... C_N>
         std::tuple<ComponentRef<C_N>...> getComponents();
         
@@ -130,16 +159,173 @@ namespace ECS {
         ID m_id = INVALID;
     };
     
+    template <size_t ... I>
+    struct IndexSequence {};
+    
+    template <size_t N, size_t ... I>
+    struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I ...> {};
+
+    
+    template <size_t ... I>
+    struct MakeIndexSequence<0, I ...> {
+        typedef IndexSequence<I ...> type;
+    };
+    
+    template <bool ... B>
+    struct BoolSequence {};
+    
+    template <typename ... T>
+    struct TypeList {};
+    
+    template <typename A, typename B>
+    struct ConcatTypeList;
+    
+    template <typename ... A, typename ... B>
+    struct ConcatTypeList<TypeList<A ...>, TypeList<B ...>> {
+        typedef TypeList<A ..., B ...> type;
+    };
+    
+    // a query term, the entities with any of the components are left out
+    template <typename ... Components>
+    struct Exclude {};
+    
+    // a query term, the components are passed as pointers, nullptr when missing
+    template <typename ... Components>
+    struct Optional {};
+    
+    // a query term, the entities with all the components changed since a tick,
+    // by getMut, patch or an assignment. it passes nothing
+    template <typename ... Components>
+    struct Changed {};
+    
+    // the typed pool of a component resolved once, then indexed directly
+    template <typename ComponentType, bool Tag = IsTagComponent<ComponentType>::value>
+    struct PoolAccessor {
+        typedef typename ComponentPool<typename std::remove_const<ComponentType>::type>::type PoolType;
+        
+        explicit PoolAccessor(BasePool *pool) : pool(static_cast<PoolType*>(pool)) {}
+        
+        inline ComponentType &operator () (uint32_t index, uint32_t slot) const { return *pool->at(index); }
+        
+        PoolType *pool;
+    };
+    
+    template <typename ComponentType>
+    struct PoolAccessor<ComponentType, true> {
+        explicit PoolAccessor(BasePool *pool) {}
+        
+        inline ComponentType &operator () (uint32_t index, uint32_t slot) const {
+            return TagInstance<typename std::remove_const<ComponentType>::type>::instance;
+        }
+    };
+    
+    // a component column of an archetype chunk
+    template <typename ComponentType, bool Tag = IsTagComponent<ComponentType>::value>
+    struct ColumnAccessor {
+        ColumnAccessor(Archetype *archetype, BaseComponent::Family family, size_t chunk)
+        : column(static_cast<ComponentType*>(archetype->column(family, chunk))) {}
+        
+        inline ComponentType &operator () (uint32_t index, uint32_t slot) const { return column[slot]; }
+        
+        ComponentType *column;
+    };
+    
+    template <typename ComponentType>
+    struct ColumnAccessor<ComponentType, true> {
+        ColumnAccessor(Archetype *archetype, BaseComponent::Family family, size_t chunk) {}
+        
+        inline ComponentType &operator () (uint32_t index, uint32_t slot) const {
+            return TagInstance<typename std::remove_const<ComponentType>::type>::instance;
+        }
+    };
+    
+    // an optional component, looked up by the mask of the entity
+    template <typename ComponentType, bool Tag = IsTagComponent<ComponentType>::value>
+    struct OptionalPoolAccessor {
+        typedef typename ComponentPool<typename std::remove_const<ComponentType>::type>::type PoolType;
+        typedef std::vector<std::bitset<MAX_COMPONENTS>> MaskList;
+        
+        // @param typed whether the pool is a PoolType, not the view of an archetype storage
+        OptionalPoolAccessor(BasePool *pool, bool typed, const MaskList *masks, BaseComponent::Family family)
+        : pool(typed ? static_cast<PoolType*>(pool) : nullptr), base(pool), masks(masks), family(family) {}
+        
+        inline ComponentType *operator () (uint32_t index, uint32_t slot) const {
+            if (!(*masks)[index].test(family))
+                return nullptr;
+            return pool ? pool->at(index) : static_cast<ComponentType*>(base->get(index));
+        }
+        
+        PoolType *pool;
+        BasePool *base;
+        const MaskList *masks;
+        BaseComponent::Family family;
+    };
+    
+    template <typename ComponentType>
+    struct OptionalPoolAccessor<ComponentType, true> {
+        typedef std::vector<std::bitset<MAX_COMPONENTS>> MaskList;
+        
+        OptionalPoolAccessor(BasePool *pool, bool typed, const MaskList *masks, BaseComponent::Family family)
+        : masks(masks), family(family) {}
+        
+        inline ComponentType *operator () (uint32_t index, uint32_t slot) const {
+            return (*masks)[index].test(family) ? &TagInstance<typename std::remove_const<ComponentType>::type>::instance : nullptr;
+        }
+        
+        const MaskList *masks;
+        BaseComponent::Family family;
+    };
+    
+    // an optional component of an archetype chunk, the archetype has it for all its rows or none
+    template <typename ComponentType, bool Tag = IsTagComponent<ComponentType>::value>
+    struct OptionalColumnAccessor {
+        typedef std::vector<std::bitset<MAX_COMPONENTS>> MaskList;
+        
+        OptionalColumnAccessor(Archetype *archetype, const MaskList *masks, BaseComponent::Family family, size_t chunk)
+        : column(archetype->hasColumn(family) ? static_cast<ComponentType*>(archetype->column(family, chunk)) : nullptr) {}
+        
+        inline ComponentType *operator () (uint32_t index, uint32_t slot) const { return column ? column + slot : nullptr; }
+        
+        ComponentType *column;
+    };
+    
+    // the tags are not in the archetypes
+    template <typename ComponentType>
+    struct OptionalColumnAccessor<ComponentType, true> : OptionalPoolAccessor<ComponentType, true> {
+        typedef std::vector<std::bitset<MAX_COMPONENTS>> MaskList;
+        
+        OptionalColumnAccessor(Archetype *archetype, const MaskList *masks, BaseComponent::Family family, size_t chunk)
+        : OptionalPoolAccessor<ComponentType, true>(nullptr, false, masks, family) {}
+    };
+    
+    template <typename ... Terms>
+    struct Query;
+    
+    template <typename Argument>
+    struct QueryArgument;
+    
     class EntityManager
     {
     public:
         typedef std::bitset<MAX_COMPONENTS> ComponentMask;
         
+        // the masks a query is compiled to
+        struct QueryMasks {
+            ComponentMask mask;
+            ComponentMask exclude;
+            // the components changed since the tick, they are in mask too
+            ComponentMask changed;
+            uint32_t since = 0;
+        };
+        
         template <class Delegate, bool All = false>
         class ViewIterator : public std::iterator<std::input_iterator_tag, Entity::ID> {
         public:
             Delegate &operator ++() {
-                ++i_;
+                if (driven_)
+                    --cursor_;
+                else
+                    ++i_;
                 next();
                 return *static_cast<Delegate*>(this);
             }
@@ -150,21 +336,82 @@ namespace ECS {
             
         protected:
             ViewIterator(EntityManager *manager, uint32_t index)
-            : manager_(manager), i_(index), capacity_(manager_->capacity()), free_cursor_(~0UL) {
-                if (All) {
-                    std::sort(manager_->m_free_list.begin(), manager_->m_free_list.end());
-                    free_cursor_ = 0;
-                }
-            }
+            : ViewIterator(manager, QueryMasks(), index) {}
             ViewIterator(EntityManager *manager, const ComponentMask mask, uint32_t index)
-            : manager_(manager), mask_(mask), i_(index), capacity_(manager_->capacity()), free_cursor_(~0UL) {
+            : ViewIterator(manager, manager->queryMasks(mask), index) {}
+            ViewIterator(EntityManager *manager, const QueryMasks &query, uint32_t index)
+            : manager_(manager), mask_(query.mask), exclude_(query.exclude), since_(query.since), i_(index), capacity_(manager_->capacity()) {
+                if (query.changed.any())
+                    changed_ = manager_->familiesOf(query.changed);
                 if (All) {
-                    std::sort(manager_->m_free_list.begin(), manager_->m_free_list.end());
-                    free_cursor_ = 0;
+                    // the entities alive, from their bitmap
+                    scanned_ = i_ < capacity_;
+                    if (scanned_)
+                        scan_ = manager_->aliveScan(capacity_);
+                }
+                else if (i_ < capacity_) {
+                    const Group *group = manager_->groupOf(mask_, exclude_);
+                    if (group) {
+                        // the group holds exactly the entities wanted, but the changes
+                        driven_ = true;
+                        matched_ = changed_.empty();
+                        packed_ = &group->entities();
+                        cursor_ = packed_->size();
+                    }
+                    else if (manager_->m_archetypes && (mask_ & ~manager_->m_tag_mask).any()) {
+                        // the archetypes matched hold only the entities wanted, but the tags
+                        driven_ = by_archetype_ = true;
+                        matched_ = ((mask_ | exclude_) & manager_->m_tag_mask).none() && changed_.empty();
+                        nextArchetype();
+                    }
+                    else {
+                        packed_ = manager_->smallestPacked(mask_);
+                        driven_ = packed_ != nullptr;
+                        cursor_ = packed_ ? packed_->size() : 0;
+                        // otherwise the bitmaps of the families are intersected,
+                        // or the one of the entities alive for an empty mask
+                        scanned_ = !driven_;
+                        if (scanned_)
+                            scan_ = manager_->scanOf(mask_, exclude_, capacity_);
+                    }
                 }
             }
             
             void next() {
+                if (driven_) {
+                    while (packed_) {
+                        // walk the packed indices backward, so removing the current one is safe
+                        cursor_ = std::min(cursor_, packed_->size());
+                        for (; cursor_ > 0; --cursor_) {
+                            i_ = (*packed_)[cursor_ - 1];
+                            if (matched_ || predicate()) {
+                                Entity entity = manager_->get(manager_->createId(i_));
+                                static_cast<Delegate*>(this)->next_entity(entity);
+                                return;
+                            }
+                        }
+                        if (by_archetype_)
+                            nextArchetype();
+                        else
+                            packed_ = nullptr;
+                    }
+                    i_ = uint32_t(capacity_);
+                    return;
+                }
+                
+                if (scanned_) {
+                    // the block intersected may be older than the mask
+                    size_t index = scan_.next();
+                    while (index != BitmapScan::END && !predicate(uint32_t(index)))
+                        index = scan_.next();
+                    i_ = index != BitmapScan::END ? uint32_t(index) : uint32_t(capacity_);
+                    if (i_ < capacity_) {
+                        Entity entity = manager_->get(manager_->createId(i_));
+                        static_cast<Delegate*>(this)->next_entity(entity);
+                    }
+                    return;
+                }
+                
                 while (i_ < capacity_ && !predicate()) {
                     ++i_;
                 }
@@ -175,24 +422,43 @@ namespace ECS {
                 }
             }
             
-            inline bool predicate() {
-                return (All && valid_entity()) || (manager_->m_entity_component_mask[i_] & mask_) == mask_;
+            void nextArchetype() {
+                Archetype *archetype = manager_->nextArchetype(mask_, exclude_, archetype_);
+                packed_ = archetype ? &archetype->entities() : nullptr;
+                cursor_ = packed_ ? packed_->size() : 0;
             }
             
-            inline bool valid_entity() {
-                const std::vector<uint32_t> &free_list = manager_->m_free_list;
-                if (free_cursor_ < free_list.size() && free_list[free_cursor_] == i_) {
-                    ++free_cursor_;
-                    return false;
-                }
-                return true;
+            inline bool predicate() const {
+                return predicate(i_);
+            }
+            
+            inline bool predicate(uint32_t index) const {
+                if (All)
+                    return manager_->m_alive.test(index);
+                const ComponentMask &mask = manager_->m_entity_component_mask[index];
+                return (mask & mask_) == mask_ && (mask & exclude_).none() &&
+                    (mask_.any() || manager_->m_alive.test(index)) &&
+                    (changed_.empty() || manager_->changedSince(index, changed_, since_));
             }
             
             EntityManager *manager_ = nullptr;
             ComponentMask mask_;
+            ComponentMask exclude_;
+            std::vector<BaseComponent::Family> changed_;
+            uint32_t since_ = 0;
             uint32_t i_ = 0;
             size_t capacity_ = 0;
-            size_t free_cursor_ = 0;
+            // the iteration is driven by the entities of a group, by the packed indices
+            // of the smallest sparse pool, or by the archetypes matched one by one,
+            // else it is scanned from the bitmaps of the families, or of the entities alive
+            bool driven_ = false;
+            bool scanned_ = false;
+            BitmapScan scan_;
+            bool matched_ = false;
+            bool by_archetype_ = false;
+            const std::vector<uint32_t> *packed_ = nullptr;
+            size_t cursor_ = 0;
+            size_t archetype_ = 0;
         };
         
         template <bool All>
@@ -201,28 +467,28 @@ namespace ECS {
             class Iterator : public ViewIterator<Iterator, All> {
             public:
                 Iterator(EntityManager *manager,
-                         const ComponentMask mask,
-                         uint32_t index) : ViewIterator<Iterator, All>(manager, mask, index) {
+                         const QueryMasks &query,
+                         uint32_t index) : ViewIterator<Iterator, All>(manager, query, index) {
                     ViewIterator<Iterator, All>::next();
                 }
                 
                 void next_entity(Entity &entity) {}
             };
             
-            Iterator begin() { return Iterator(manager_, mask_, 0); }
-            Iterator end() { return Iterator(manager_, mask_, uint32_t(manager_->capacity())); }
-            const Iterator begin() const { return Iterator(manager_, mask_, 0); }
-            const Iterator end() const { return Iterator(manager_, mask_, manager_->capacity()); }
+            Iterator begin() { return Iterator(manager_, query_, 0); }
+            Iterator end() { return Iterator(manager_, query_, uint32_t(manager_->capacity())); }
+            const Iterator begin() const { return Iterator(manager_, query_, 0); }
+            const Iterator end() const { return Iterator(manager_, query_, manager_->capacity()); }
             
-        private:
+        protected:
             friend class EntityManager;
             
-            explicit BaseView(EntityManager *manager) : manager_(manager) { mask_.set(); }
-            BaseView(EntityManager *manager, ComponentMask mask) :
-            manager_(manager), mask_(mask) {}
+            explicit BaseView(EntityManager *manager) : manager_(manager) { query_.mask.set(); }
+            BaseView(EntityManager *manager, const QueryMasks &query) :
+            manager_(manager), query_(query) {}
             
             EntityManager *manager_ = nullptr;
-            ComponentMask mask_;
+            QueryMasks query_;
         };
         
         template <bool All, typename ... Components>
@@ -230,21 +496,81 @@ namespace ECS {
         public:
             template <typename T> struct identity { typedef T type; };
             
-            void each(typename identity<std::function<void(Entity entity, Components&...)>>::type f) {
+            // f(Entity entity, Components &...), inlined, the components are reached
+            // through the pools resolved once for the whole view.
+            // an Exclude term passes nothing, an Optional one passes pointers
+            template <typename F>
+            void each(F f) {
+                each(f, std::integral_constant<bool, All>());
+            }
+            
+        private:
+            template <typename F>
+            void each(F &f, std::true_type) {
                 for (auto it : *this)
                     f(it, *(it.template getComponent<Components>().get())...);
             }
             
-        private:
+            template <typename F>
+            void each(F &f, std::false_type) {
+                this->manager_->eachMatching(typename Query<Components...>::Arguments(), this->query_, f);
+            }
+            
             friend class EntityManager;
             
             explicit TypedView(EntityManager *manager) : BaseView<All>(manager) {}
-            TypedView(EntityManager *manager, ComponentMask mask) : BaseView<All>(manager, mask) {}
+            TypedView(EntityManager *manager, const QueryMasks &query) : BaseView<All>(manager, query) {}
         };
         
         template <typename ... Components> using View = TypedView<false, Components...>;
+        // all the entities alive
         typedef BaseView<true> DebugView;
         
+        // the entities with a component, in the order of a key of it
+        template <typename ComponentType>
+        class SortedView {
+        public:
+            class Iterator : public std::iterator<std::input_iterator_tag, Entity> {
+            public:
+                Iterator(EntityManager *manager, const uint32_t *cursor) : manager_(manager), cursor_(cursor) {}
+                
+                Iterator &operator ++ () {
+                    ++cursor_;
+                    return *this;
+                }
+                bool operator == (const Iterator &rhs) const { return cursor_ == rhs.cursor_; }
+                bool operator != (const Iterator &rhs) const { return cursor_ != rhs.cursor_; }
+                Entity operator * () const { return Entity(manager_, manager_->createId(*cursor_)); }
+                
+            private:
+                EntityManager *manager_ = nullptr;
+                const uint32_t *cursor_ = nullptr;
+            };
+            
+            Iterator begin() const { return Iterator(manager_, entities_->data()); }
+            Iterator end() const { return Iterator(manager_, entities_->data() + entities_->size()); }
+            
+            size_t size() const { return entities_->size(); }
+            
+            // f(Entity entity, ComponentType &), in order
+            template <typename F>
+            void each(F f) {
+                for (uint32_t index : *entities_) {
+                    Entity::ID id = manager_->createId(index);
+                    f(Entity(manager_, id), *manager_->template getComponentPtr<ComponentType>(id));
+                }
+            }
+            
+        private:
+            friend class EntityManager;
+            
+            SortedView(EntityManager *manager, const std::vector<uint32_t> *entities) :
+            manager_(manager), entities_(entities) {}
+            
+            EntityManager *manager_ = nullptr;
+            const std::vector<uint32_t> *entities_ = nullptr;
+        };
+        
         template <typename ... Components>
         class UnpackingView {
         public:
@@ -309,11 +635,27 @@ namespace ECS {
         };
         
     public:
-        EntityManager();
+        enum Layout
+        {
+            // a pool for each component type
+            LAYOUT_POOL,
+            // the entities with the same components are kept together in chunks
+            LAYOUT_ARCHETYPE
+        };
+        
+    public:
+        explicit EntityManager(Layout layout = LAYOUT_POOL);
         ~EntityManager();
         
+        Layout layout() const {
+            return m_archetypes ? LAYOUT_ARCHETYPE : LAYOUT_POOL;
+        }
+        
         void setEventSystem(EventSystem *event_system);
         
+        // the workers of parallelEach, the shared pool when not set
+        void setThreadPool(ThreadPool *thread_pool);
+        
         void clear();
         
         EventSystem *getEventSystem() {
@@ -330,12 +672,36 @@ namespace ECS {
         
         inline Entity::ID createId(uint32_t index) const;
         
+        // prepare the entity tables for count entities, no reallocation until then
+        void reserve(size_t count);
+        
+        // prepare the pool of the component type for count components
+        template <typename ComponentType>
+        void reserveComponent(size_t count);
+        
         Entity create();
         
+        // create count entities at once, appended to out
+        void createMany(size_t count, std::vector<Entity> &out);
+        
         void destroy(Entity::ID id);
         
         void destroyNoNotify(Entity::ID id);
         
+        // destroy the entities at once, BeforeRemoveEntities is sent once for all of them,
+        // the ids invalid or repeated are skipped
+        void destroyMany(const Entity::ID *ids, size_t count);
+        
+        void destroyMany(const std::vector<Entity::ID> &ids);
+        
+        // the old id and the new one of an entity moved by compact
+        typedef std::function<void(Entity::ID from, Entity::ID to)> RemapCallback;
+        
+        // move the entities alive into the lowest indices, then release the tables and
+        // the pools beyond them, remap is called for every entity moved.
+        // the ids destroyed before and the old ids of the entities moved stay invalid
+        void compact(RemapCallback remap = nullptr);
+        
         template <typename ComponentType>
         BaseComponent::Family component_family() const;
         
@@ -368,6 +734,15 @@ namespace ECS {
 
 		template <typename Component>
 		ComponentRef<Component> assignComponentFrom(Entity::ID id, const Component &source);
+
+		// move the component in, the overload is for the rvalues only
+		template <typename Component, typename = typename std::enable_if<!std::is_reference<Component>::value>::type>
+		ComponentRef<Component> assignComponentFrom(Entity::ID id, Component &&source);
+
+		// construct the component in place with the arguments, 
+		// an existing one is assigned from them
+		template <typename Component, typename ... Args>
+		ComponentRef<Component> emplaceComponent(Entity::ID id, Args && ... args);
         
         template <typename ComponentType>
         void removeComponent(Entity::ID id);
@@ -378,6 +753,26 @@ namespace ECS {
         template <typename ComponentType>
         const ComponentType *getComponentPtr(Entity::ID id) const;
         
+        // the changes are stamped with the current tick, Changed<...> terms take the
+        // ones made at a tick or later. advance it after a pass over the changes,
+        // so the next pass sees only the ones made since
+        uint32_t changeTick() const {
+            return m_change_tick;
+        }
+        
+        uint32_t advanceChangeTick() {
+            return ++m_change_tick;
+        }
+        
+        // the component to change, its change tick is set.
+        // the changes through a ComponentRef are not tracked, nor allowed in parallelEach
+        template <typename ComponentType>
+        ComponentType *getMut(Entity::ID id);
+        
+        // f(ComponentType &) changes the component, then OnChangedComponent is sent
+        template <typename ComponentType, typename F>
+        void patch(Entity::ID id, F f);
+        
         template <typename ComponentType>
         ComponentMask componentMask();
         
@@ -393,7 +788,7 @@ namespace ECS {
         inline ComponentMask componentMask(Entity::ID id);
         
         template <typename ComponentType>
-        inline Pool<ComponentType> *accommodateComponent();
+        inline BasePool *accommodateComponent();
         
         inline void accommodateEntity(uint32_t index);
         
@@ -403,26 +798,261 @@ namespace ECS {
         template <typename C_1, typename ... C_N>
         void unpack(Entity::ID id, ComponentRef<C_1> &c1, ComponentRef<C_N> &... cn);
         
+        // the terms are the components required, Exclude<...>, Optional<...> and
+        // Changed<...>, which takes the changes made at the tick since or later
+        template <typename ... C_N>
+        View<C_N...> entitiesWithComponents(uint32_t since = 0);
+        
+        // the entities with the component, ordered by key(const ComponentType &).
+        // the order is kept for the next call, which only repairs it, so a frame
+        // with a few keys changed costs about O(n). one order for each component type.
+        // a sparse pool is rearranged in that order as well.
+        // the view is valid until the entities or the components change
+        template <typename ComponentType, typename Key>
+        SortedView<ComponentType> sortedView(Key key);
+        
+        // all the entities alive, in the order of their indices
+        DebugView allEntities() {
+            return DebugView(this);
+        }
+        
+        // register a group for the components, once, the views and each over exactly
+        // these components then walk its entities instead of searching them
         template <typename ... C_N>
-        View<C_N...> entitiesWithComponents();
+        const Group &group();
+        
+        const Group &group(const ComponentMask &mask, const ComponentMask &exclude = ComponentMask());
         
         template <typename T> struct identity { typedef T type; };
         
-        template <typename ... C_N>
-        void each(typename identity<std::function<void(Entity entity, C_N&...)>>::type f);
+        // f(Entity entity, C_N &...) for all the entities with the components,
+        // C *... for an Optional<C...> term, nothing for an Exclude<...> or a Changed<...> one.
+        // with a Changed<...> term, only the blocks of the entities changed are visited
+        template <typename ... C_N, typename F>
+        void each(F f, uint32_t since = 0);
+        
+        // f(Span<const Entity::ID> ids, Span<C_N>...) for the runs of the matching entities
+        // whose components are contiguous, the runs follow the pool pages or the
+        // archetype chunks. Exclude<...> terms are allowed, the tags only in them.
+        // f must not add or remove the components, nor the entities
+        template <typename ... C_N, typename F>
+        void forEachChunk(F f);
+        
+        // each() with the entities split in ranges of about grain_size, run on the workers.
+        // f is called from several threads at once, it may change the components it is
+        // passed, but the structure must not change until the call returns: no entity
+        // created or destroyed, no component assigned or removed
+        template <typename ... C_N, typename F>
+        void parallelEach(F f, size_t grain_size = 4096);
         
     private:
         friend class Entity;
         template <typename ComponentType, typename Container>
         friend class ComponentRef;
+        template <typename Argument>
+        friend struct QueryArgument;
+        
+        // the structure locked for a scope, unlocked again even if the walk throws
+        class LockGuard {
+        public:
+            explicit LockGuard(bool &locked) : m_locked(locked), m_previous(locked) { m_locked = true; }
+            ~LockGuard() { m_locked = m_previous; }
+            
+            LockGuard(const LockGuard &) = delete;
+            LockGuard &operator = (const LockGuard &) = delete;
+            
+        private:
+            bool &m_locked;
+            bool m_previous;
+        };
+        
+        template <typename Component, typename ... Args>
+        Component *constructComponent(uint32_t index, Args && ... args);
+        
+        inline const std::vector<uint32_t> *smallestPacked(const ComponentMask &mask) const;
+        
+        inline Archetype *nextArchetype(const ComponentMask &mask, const ComponentMask &exclude, size_t &cursor) const;
+        
+        inline const Group *groupOf(const ComponentMask &mask, const ComponentMask &exclude) const;
+        
+        // the entities below limit with all the families of the mask, and none of exclude,
+        // the entities alive for an empty mask
+        inline BitmapScan scanOf(const ComponentMask &mask, const ComponentMask &exclude, size_t limit, size_t begin = 0) const;
+        
+        QueryMasks queryMasks(const ComponentMask &mask) const {
+            QueryMasks query;
+            query.mask = mask;
+            return query;
+        }
+        
+        inline std::vector<BaseComponent::Family> familiesOf(const ComponentMask &mask) const;
+        
+        // whether all the families changed at the tick since or later
+        inline bool changedSince(uint32_t index, const std::vector<BaseComponent::Family> &families, uint32_t since) const;
+        
+        inline BitmapScan aliveScan(size_t limit) const {
+            return BitmapScan(std::vector<const Bitmap*>(1, &m_alive), std::vector<const Bitmap*>(), limit);
+        }
+        
+        // keep the bitmaps of the families up to date with the mask of the entity
+        inline void clearFamilies(uint32_t index, const ComponentMask &mask);
+        
+        // keep the groups up to date, after the mask of the entity is changed
+        inline void updateGroups(uint32_t index, const ComponentMask &before);
+        
+        inline BasePool *poolOf(BaseComponent::Family family) const {
+            return family < m_component_pools.size() ? m_component_pools[family] : nullptr;
+        }
+        
+        // Arguments are the query terms passed to f, Optional<C> for the optional ones
+        template <typename ... Arguments, typename F>
+        void eachMatching(TypeList<Arguments...>, const QueryMasks &query, F &f);
+        
+        template <typename F, typename Accessors, size_t ... I>
+        static inline void invoke(F &f, Entity entity, uint32_t index, uint32_t slot, Accessors &accessors, IndexSequence<I...>) {
+            f(entity, std::get<I>(accessors)(index, slot) ...);
+        }
+        
+        // keep a sparse pool in the order of a sorted view, the other pools can not move
+        template <typename T>
+        static void arrangePool(SparsePool<T> *pool, const std::vector<uint32_t> &order) {
+            pool->arrange(order);
+        }
+        
+        template <typename T>
+        static void arrangePool(Pool<T> *pool, const std::vector<uint32_t> &order) {}
+        
+        template <typename ... Arguments, typename F>
+        void parallelMatching(TypeList<Arguments...>, const ComponentMask &mask, const ComponentMask &exclude, F &f, size_t grain_size);
+        
+        template <typename ... Arguments, typename F>
+        void chunksMatching(TypeList<Arguments...>, const ComponentMask &mask, const ComponentMask &exclude, F &f);
+        
+        // the run of length from index, slot in the columns
+        template <typename F, typename Accessors, typename ... Arguments, size_t ... I>
+        static inline void invokeSpans(F &f, const std::vector<Entity::ID> &ids, uint32_t index, uint32_t slot, size_t length,
+                                       Accessors &accessors, TypeList<Arguments...>, IndexSequence<I...>) {
+            f(Span<const Entity::ID>(ids.data(), length), Span<Arguments>(&std::get<I>(accessors)(index, slot), length) ...);
+        }
+        
+        // whether the components of next follow the ones of the run from index
+        template <typename Accessors, size_t ... I>
+        static inline bool contiguous(Accessors &accessors, uint32_t index, size_t length, uint32_t next, IndexSequence<I...>) {
+            bool follow = true;
+            int expand[] = { 0, (follow = follow && &std::get<I>(accessors)(next, next) == &std::get<I>(accessors)(index, index) + length, 0) ... };
+            (void)expand;
+            return follow;
+        }
         
     private:
         uint32_t m_index_counter = 0;
+        // the first version of a new index, above the ones released by compact
+        uint32_t m_version_floor = 1;
         std::vector<BasePool*> m_component_pools;
         std::vector<ComponentMask> m_entity_component_mask;
+        // the transposed masks, the entity indices having each family
+        std::vector<Bitmap> m_family_bitmaps;
+        // the ticks of the changes, by the family
+        std::vector<ChangeTicks> m_change_ticks;
+        uint32_t m_change_tick = 1;
         std::vector<uint32_t> m_entity_version;
         std::vector<uint32_t> m_free_list;
+        // the indices of the entities alive
+        Bitmap m_alive;
         EventSystem *m_event_system = nullptr;
+        ThreadPool *m_thread_pool = nullptr;
+        // set during a parallelEach, the structure must not change
+        bool m_locked = false;
+        std::vector<std::unique_ptr<Group>> m_groups;
+        // the orders of the sorted views, by the component family
+        std::vector<std::unique_ptr<SortedGroup>> m_sorted;
+        // the tag components, no pool for them
+        ComponentMask m_tag_mask;
+        // only for the archetype layout
+        std::unique_ptr<ArchetypeStorage> m_archetypes;
+    };
+    
+    // the masks of a query term, and the arguments it passes to the callback
+    template <typename Term>
+    struct QueryTerm {
+        typedef TypeList<Term> Arguments;
+        
+        static void masks(EntityManager *manager, EntityManager::QueryMasks &query) {
+            query.mask.set(manager->component_family<Term>());
+        }
+    };
+    
+    template <typename ... Components>
+    struct QueryTerm<Exclude<Components...>> {
+        typedef TypeList<> Arguments;
+        
+        static void masks(EntityManager *manager, EntityManager::QueryMasks &query) {
+            query.exclude |= manager->componentMask<Components...>();
+        }
+    };
+    
+    template <typename ... Components>
+    struct QueryTerm<Optional<Components...>> {
+        typedef TypeList<Optional<Components>...> Arguments;
+        
+        static void masks(EntityManager *manager, EntityManager::QueryMasks &query) {}
+    };
+    
+    template <typename ... Components>
+    struct QueryTerm<Changed<Components...>> {
+        typedef TypeList<> Arguments;
+        
+        static void masks(EntityManager *manager, EntityManager::QueryMasks &query) {
+            query.mask |= manager->componentMask<Components...>();
+            query.changed |= manager->componentMask<Components...>();
+        }
+    };
+    
+    template <>
+    struct Query<> {
+        typedef TypeList<> Arguments;
+        
+        static void masks(EntityManager *manager, EntityManager::QueryMasks &query) {}
+    };
+    
+    template <typename Term, typename ... Terms>
+    struct Query<Term, Terms...> {
+        typedef typename ConcatTypeList<typename QueryTerm<Term>::Arguments, typename Query<Terms...>::Arguments>::type Arguments;
+        
+        static void masks(EntityManager *manager, EntityManager::QueryMasks &query) {
+            QueryTerm<Term>::masks(manager, query);
+            Query<Terms...>::masks(manager, query);
+        }
+    };
+    
+    // how an argument of a query reaches its component, in the pools or in the columns
+    template <typename Argument>
+    struct QueryArgument {
+        typedef PoolAccessor<Argument> Pool;
+        typedef ColumnAccessor<Argument> Column;
+        
+        static Pool pool(EntityManager *manager) {
+            return Pool(manager->poolOf(manager->component_family<Argument>()));
+        }
+        
+        static Column column(EntityManager *manager, Archetype *archetype, size_t chunk) {
+            return Column(archetype, manager->component_family<Argument>(), chunk);
+        }
+    };
+    
+    template <typename Argument>
+    struct QueryArgument<Optional<Argument>> {
+        typedef OptionalPoolAccessor<Argument> Pool;
+        typedef OptionalColumnAccessor<Argument> Column;
+        
+        static Pool pool(EntityManager *manager) {
+            BaseComponent::Family family = manager->component_family<Argument>();
+            return Pool(manager->poolOf(family), !manager->m_archetypes, &manager->m_entity_component_mask, family);
+        }
+        
+        static Column column(EntityManager *manager, Archetype *archetype, size_t chunk) {
+            return Column(archetype, &manager->m_entity_component_mask, manager->component_family<Argument>(), chunk);
+        }
     };
     
     
@@ -25,6 +25,18 @@ namespace ECS {
         return m_manager->assignComponentFrom<ComponentType>(m_id, component);
     }
     
+    template <typename ComponentType, typename>
+    ComponentRef<ComponentType> Entity::assignComponentFrom(ComponentType &&component)
+    {
+        return m_manager->assignComponentFrom<ComponentType>(m_id, std::move(component));
+    }
+    
+    template <typename ComponentType, typename ... Args>
+    ComponentRef<ComponentType> Entity::emplaceComponent(Args && ... args)
+    {
+        return m_manager->emplaceComponent<ComponentType>(m_id, std::forward<Args>(args) ...);
+    }
+    
     template <typename ComponentType>
     void Entity::removeComponent()
     {
@@ -43,6 +55,18 @@ namespace ECS {
         return m_manager->getComponent<ComponentType, const EntityManager>(m_id);
     }
     
+    template <typename ComponentType>
+    ComponentType *Entity::getMut()
+    {
+        return m_manager->getMut<ComponentType>(m_id);
+    }
+    
+    template <typename ComponentType, typename F>
+    void Entity::patch(F f)
+    {
+        m_manager->patch<ComponentType>(m_id, f);
+    }
+    
     template <typename ... C_N>
     std::tuple<ComponentRef<C_N>...> Entity::getComponents()
     {
@@ -118,6 +142,8 @@ namespace ECS {
     template <typename ComponentType>
     bool EntityManager::hasComponent(Entity::ID id) const {
         BaseComponent::Family family = component_family<ComponentType>();
+        if (IsTagComponent<ComponentType>::value)
+            return m_entity_component_mask[id.index()][family];
         if (family >= m_component_pools.size())
             return false;
         BasePool *pool = m_component_pools[family];
@@ -145,6 +171,8 @@ namespace ECS {
     ComponentRef<ComponentType> EntityManager::getComponent(Entity::ID id)
     {
         BaseComponent::Family family = component_family<ComponentType>();
+        if (IsTagComponent<ComponentType>::value && m_entity_component_mask[id.index()][family])
+            return ComponentRef<ComponentType, EntityManager>(this, id);
         if (family >= m_component_pools.size())
             return ComponentRef<ComponentType, EntityManager>();
         BasePool *pool = m_component_pools[family];
@@ -157,6 +185,8 @@ namespace ECS {
     const ComponentRef<ComponentType, const EntityManager> EntityManager::getComponent(Entity::ID id) const
     {
         BaseComponent::Family family = component_family<ComponentType>();
+        if (IsTagComponent<ComponentType>::value && m_entity_component_mask[id.index()][family])
+            return ComponentRef<ComponentType, const EntityManager>(this, id);
         if (family > m_component_pools.size())
             return ComponentRef<ComponentType, const EntityManager>();
         BasePool *pool = m_component_pools[family];
@@ -180,9 +210,16 @@ namespace ECS {
 	template <typename Component>
 	ComponentRef<Component> EntityManager::assignComponent(Entity::ID id)
 	{
+		assert(!m_locked);
 		BaseComponent::Family family = component_family<Component>();
-        accommodateComponent<Component>();
+		BasePool *pool = accommodateComponent<Component>();
+		if (pool)
+			pool->assign(id.index());
+		const ComponentMask before = m_entity_component_mask[id.index()];
 		m_entity_component_mask[id.index()].set(family);
+		m_family_bitmaps[family].set(id.index());
+		m_change_ticks[family].touch(id.index(), m_change_tick);
+		updateGroups(id.index(), before);
 
 		ComponentRef<Component> component(this, id);
 
@@ -196,11 +233,25 @@ namespace ECS {
 	template <typename Component>
 	ComponentRef<Component> EntityManager::assignComponentFrom(Entity::ID id, const Component &source)
 	{
-		BaseComponent::Family family = component_family<Component>();
-		Pool<Component> *pool = accommodateComponent<Component>();
-		(*(Component*)pool->get(id.index())) = source;
+		return emplaceComponent<Component>(id, source);
+	}
 
+	template <typename Component, typename>
+	ComponentRef<Component> EntityManager::assignComponentFrom(Entity::ID id, Component &&source)
+	{
+		return emplaceComponent<Component>(id, std::move(source));
+	}
+
+	template <typename Component, typename ... Args>
+	ComponentRef<Component> EntityManager::emplaceComponent(Entity::ID id, Args && ... args)
+	{
+		BaseComponent::Family family = component_family<Component>();
+		constructComponent<Component>(id.index(), std::forward<Args>(args) ...);
+		const ComponentMask before = m_entity_component_mask[id.index()];
 		m_entity_component_mask[id.index()].set(family);
+		m_family_bitmaps[family].set(id.index());
+		m_change_ticks[family].touch(id.index(), m_change_tick);
+		updateGroups(id.index(), before);
 
 		ComponentRef<Component> component(this, id);
 
@@ -210,38 +261,75 @@ namespace ECS {
 		}
 		return component;
 	}
+
+	template <typename Component, typename ... Args>
+	Component *EntityManager::constructComponent(uint32_t index, Args && ... args)
+	{
+		assert(!m_locked);
+		BasePool *pool = accommodateComponent<Component>();
+		if (!pool)
+			return &TagInstance<Component>::instance;
+		if (m_archetypes) {
+			bool constructed = false;
+			Component *slot = static_cast<Component*>(m_archetypes->claim(component_family<Component>(), index, constructed));
+			if (constructed)
+				*slot = Component(std::forward<Args>(args) ...);
+			else
+				new (slot) Component(std::forward<Args>(args) ...);
+			return slot;
+		}
+		typedef typename ComponentPool<Component>::type PoolType;
+		return static_cast<PoolType*>(pool)->emplace(index, std::forward<Args>(args) ...);
+	}
     
     template <typename ComponentType>
     void EntityManager::removeComponent(Entity::ID id)
     {
+        assert(!m_locked);
         BaseComponent::Family family = component_family<ComponentType>();
         const uint32_t index = id.index();
         
-        BasePool *pool = m_component_pools[family];
+        BasePool *pool = IsTagComponent<ComponentType>::value ? nullptr : m_component_pools[family];
         ComponentRef<ComponentType> component(this, id);
+        const ComponentMask before = m_entity_component_mask[id.index()];
         m_entity_component_mask[id.index()].reset(family);
+        m_family_bitmaps[family].reset(index);
+        updateGroups(id.index(), before);
         
         if (m_event_system) {
             Entity entity(this, id);
             m_event_system->send(entity, *BeforeRemoveComponent::getInstance());
         }
-        pool->destroy(index);
+        if (pool)
+            pool->destroy(index);
     }
     
     template <typename ComponentType>
     ComponentType *EntityManager::getComponentPtr(Entity::ID id)
     {
+        if (IsTagComponent<ComponentType>::value)
+            return &TagInstance<typename std::remove_const<ComponentType>::type>::instance;
         BaseComponent::Family family = component_family<ComponentType>();
         BasePool *pool = m_component_pools[family];
-        return static_cast<ComponentType*>(pool->get(id.index()));
+        if (m_archetypes)
+            return static_cast<ComponentType*>(pool->get(id.index()));
+        // the pool type is known here, no virtual call
+        typedef typename ComponentPool<typename std::remove_const<ComponentType>::type>::type PoolType;
+        return static_cast<PoolType*>(pool)->at(id.index());
     }
     
     template <typename ComponentType>
     const ComponentType *EntityManager::getComponentPtr(Entity::ID id) const
     {
+        if (IsTagComponent<ComponentType>::value)
+            return &TagInstance<typename std::remove_const<ComponentType>::type>::instance;
         BaseComponent::Family family = component_family<ComponentType>();
         BasePool *pool = m_component_pools[family];
-        return static_cast<const ComponentType*>(pool->get(id.index()));
+        if (m_archetypes)
+            return static_cast<const ComponentType*>(pool->get(id.index()));
+        // the pool type is known here, no virtual call
+        typedef typename ComponentPool<typename std::remove_const<ComponentType>::type>::type PoolType;
+        return static_cast<const PoolType*>(pool)->at(id.index());
     }
     
     template <typename ComponentType>
@@ -276,9 +364,15 @@ namespace ECS {
     }
     
     template <typename ComponentType>
-    inline Pool<ComponentType> *EntityManager::accommodateComponent()
+    inline BasePool *EntityManager::accommodateComponent()
     {
         BaseComponent::Family family = component_family<ComponentType>();
+        if (IsTagComponent<ComponentType>::value)
+        {
+            // tags keep the mask bit only
+            m_tag_mask.set(family);
+            return nullptr;
+        }
         if (m_component_pools.size() <= family)
         {
             m_component_pools.resize(family + 1, nullptr);
@@ -286,22 +380,67 @@ namespace ECS {
         
         if (!m_component_pools[family])
         {
-            Pool<ComponentType> *pool = new Pool<ComponentType>();
-            pool->expand(m_index_counter);
+            BasePool *pool = nullptr;
+            if (m_archetypes)
+                pool = new ArchetypePool<ComponentType>(m_archetypes.get(), family);
+            else
+                pool = new typename ComponentPool<ComponentType>::type();
             m_component_pools[family] = pool;
         }
-        return static_cast<Pool<ComponentType> *>(m_component_pools[family]);
+        return m_component_pools[family];
+    }
+    
+    template <typename ComponentType>
+    void EntityManager::reserveComponent(size_t count)
+    {
+        BasePool *pool = accommodateComponent<ComponentType>();
+        if (pool)
+            pool->reserve(count);
+    }
+    
+    inline const std::vector<uint32_t> *EntityManager::smallestPacked(const ComponentMask &mask) const
+    {
+        const std::vector<uint32_t> *smallest = nullptr;
+        for (size_t i = 0; i < m_component_pools.size(); i++)
+        {
+            BasePool *pool = m_component_pools[i];
+            if (!pool || !mask.test(i))
+                continue;
+            const std::vector<uint32_t> *packed = pool->packed();
+            if (packed && (!smallest || packed->size() < smallest->size()))
+                smallest = packed;
+        }
+        return smallest;
+    }
+    
+    inline Archetype *EntityManager::nextArchetype(const ComponentMask &mask, const ComponentMask &exclude, size_t &cursor) const
+    {
+        if (!m_archetypes)
+            return nullptr;
+        // the tags are not in the archetypes
+        const ComponentMask wanted = mask & ~m_tag_mask;
+        const std::vector<Archetype*> &archetypes = m_archetypes->archetypes();
+        while (cursor < archetypes.size())
+        {
+            Archetype *archetype = archetypes[cursor++];
+            if (archetype->size() && (archetype->mask() & wanted) == wanted && (archetype->mask() & exclude).none())
+                return archetype;
+        }
+        return nullptr;
     }
     
     inline void EntityManager::accommodateEntity(uint32_t index)
     {
         if (m_entity_component_mask.size() <= index)
         {
+            // grow geometrically, all the tables at once
+            if (m_entity_component_mask.capacity() <= index)
+                reserve(std::max<size_t>(index + 1, m_entity_component_mask.capacity() * 2));
             m_entity_component_mask.resize(index + 1);
             m_entity_version.resize(index + 1);
-            for (BasePool *pool : m_component_pools)
-                if (pool)
-                    pool->expand(index + 1);
+            // the pools grow by themselves when the components are assigned
+            if (m_archetypes)
+                m_archetypes->accommodate(index + 1);
         }
     }
     
@@ -318,17 +457,369 @@ namespace ECS {
         unpack<C_N ...>(id, cn ...);
     }
     
+    template <typename ComponentType>
+    ComponentType *EntityManager::getMut(Entity::ID id)
+    {
+        assert(!m_locked);
+        m_change_ticks[component_family<ComponentType>()].touch(id.index(), m_change_tick);
+        return getComponentPtr<ComponentType>(id);
+    }
+    
+    template <typename ComponentType, typename F>
+    void EntityManager::patch(Entity::ID id, F f)
+    {
+        f(*getMut<ComponentType>(id));
+        if (m_event_system) {
+            Entity entity(this, id);
+            m_event_system->send(entity, *OnChangedComponent::getInstance());
+        }
+    }
+    
     template <typename ... C_N>
-    EntityManager::View<C_N...> EntityManager::entitiesWithComponents()
+    EntityManager::View<C_N...> EntityManager::entitiesWithComponents(uint32_t since)
+    {
+        QueryMasks query;
+        Query<C_N...>::masks(this, query);
+        query.since = since;
+        return View<C_N...>(this, query);
+    }
+    
+    template <typename ComponentType, typename Key>
+    EntityManager::SortedView<ComponentType> EntityManager::sortedView(Key key)
     {
-        auto mask = componentMask<C_N ...>();
-        return View<C_N...>(this, mask);
+        static_assert(!IsTagComponent<ComponentType>::value, "a tag has no key");
+        typedef typename std::decay<decltype(key(std::declval<const ComponentType&>()))>::type KeyType;
+        
+        BaseComponent::Family family = component_family<ComponentType>();
+        BasePool *pool = accommodateComponent<ComponentType>();
+        if (m_sorted.size() <= family)
+            m_sorted.resize(family + 1);
+        if (!m_sorted[family])
+            m_sorted[family] = std::unique_ptr<SortedGroup>(new SortedGroup());
+        SortedGroup &sorted = *m_sorted[family];
+        
+        // the key of each entity is taken once
+        size_t kept = sorted.update(m_family_bitmaps[family], capacity());
+        std::vector<std::pair<KeyType, uint32_t>> keys;
+        keys.reserve(sorted.entities().size());
+        for (uint32_t index : sorted.entities())
+            keys.push_back(std::make_pair(key(*getComponentPtr<ComponentType>(createId(index))), index));
+        sorted.sort(keys, kept);
+        
+        if (!m_archetypes)
+            arrangePool(static_cast<typename ComponentPool<ComponentType>::type*>(pool), sorted.entities());
+        return SortedView<ComponentType>(this, &sorted.entities());
     }
     
     template <typename ... C_N>
-    void EntityManager::each(typename identity<std::function<void(Entity entity, C_N&...)>>::type f)
+    const Group &EntityManager::group()
+    {
+        QueryMasks query;
+        Query<C_N...>::masks(this, query);
+        assert(query.changed.none());
+        return group(query.mask, query.exclude);
+    }
+    
+    inline const Group *EntityManager::groupOf(const ComponentMask &mask, const ComponentMask &exclude) const
+    {
+        for (auto &group : m_groups)
+        {
+            if (group->mask() == mask && group->exclude() == exclude)
+                return group.get();
+        }
+        return nullptr;
+    }
+    
+    inline BitmapScan EntityManager::scanOf(const ComponentMask &mask, const ComponentMask &exclude, size_t limit, size_t begin) const
     {
-        return entitiesWithComponents<C_N...>().each(f);
+        std::vector<const Bitmap*> bitmaps, excluded;
+        if (mask.none())
+            bitmaps.push_back(&m_alive);
+        for (size_t i = 0; i < MAX_COMPONENTS; i++)
+        {
+            if (mask.test(i))
+                bitmaps.push_back(&m_family_bitmaps[i]);
+            else if (exclude.test(i))
+                excluded.push_back(&m_family_bitmaps[i]);
+        }
+        return BitmapScan(bitmaps, excluded, limit, begin);
+    }
+    
+    inline std::vector<BaseComponent::Family> EntityManager::familiesOf(const ComponentMask &mask) const
+    {
+        std::vector<BaseComponent::Family> families;
+        for (size_t i = 0; i < MAX_COMPONENTS; i++)
+        {
+            if (mask.test(i))
+                families.push_back(BaseComponent::Family(i));
+        }
+        return families;
+    }
+    
+    inline bool EntityManager::changedSince(uint32_t index, const std::vector<BaseComponent::Family> &families, uint32_t since) const
+    {
+        for (BaseComponent::Family family : families)
+        {
+            if (m_change_ticks[family].tick(index) < since)
+                return false;
+        }
+        return true;
+    }
+    
+    inline void EntityManager::clearFamilies(uint32_t index, const ComponentMask &mask)
+    {
+        for (size_t i = 0; i < MAX_COMPONENTS; i++)
+        {
+            if (mask.test(i))
+                m_family_bitmaps[i].reset(index);
+        }
+    }
+    
+    inline void EntityManager::updateGroups(uint32_t index, const ComponentMask &before)
+    {
+        for (auto &group : m_groups)
+            group->update(index, before, m_entity_component_mask[index]);
+    }
+    
+    template <typename ... C_N, typename F>
+    void EntityManager::each(F f, uint32_t since)
+    {
+        entitiesWithComponents<C_N...>(since).each(f);
+    }
+    
+    template <typename ... Arguments, typename F>
+    void EntityManager::eachMatching(TypeList<Arguments...>, const QueryMasks &query, F &f)
+    {
+        typedef typename MakeIndexSequence<sizeof...(Arguments)>::type Indices;
+        const ComponentMask &mask = query.mask;
+        const ComponentMask &exclude = query.exclude;
+        std::vector<BaseComponent::Family> changed;
+        if (query.changed.any())
+            changed = familiesOf(query.changed);
+        
+        if (m_archetypes && (mask & ~m_tag_mask).any())
+        {
+            // chunk by chunk, the columns are resolved once for each chunk
+            const bool tags = ((mask | exclude) & m_tag_mask).any();
+            size_t cursor = 0;
+            while (Archetype *archetype = nextArchetype(mask, exclude, cursor))
+            {
+                const std::vector<uint32_t> &entities = archetype->entities();
+                const size_t chunk_capacity = archetype->chunkCapacity();
+                // backward, so removing the current one is safe: the last row moved into
+                // its place is visited already. f may have emptied the chunks since
+                for (size_t chunk = archetype->chunks(); chunk > 0; chunk = std::min(chunk - 1, archetype->chunks()))
+                {
+                    std::tuple<typename QueryArgument<Arguments>::Column...> columns(QueryArgument<Arguments>::column(this, archetype, chunk - 1)...);
+                    const size_t first = (chunk - 1) * chunk_capacity;
+                    for (size_t row = std::min(entities.size(), first + chunk_capacity); row > first; row = std::min(row - 1, entities.size()))
+                    {
+                        uint32_t index = entities[row - 1];
+                        if (tags && ((m_entity_component_mask[index] & mask) != mask || (m_entity_component_mask[index] & exclude).any()))
+                            continue;
+                        if (!changed.empty() && !changedSince(index, changed, query.since))
+                            continue;
+                        invoke(f, Entity(this, createId(index)), index, uint32_t(row - 1 - first), columns, Indices());
+                    }
+                }
+            }
+            return;
+        }
+        
+        std::tuple<typename QueryArgument<Arguments>::Pool...> pools(QueryArgument<Arguments>::pool(this)...);
+        if (!changed.empty())
+        {
+            // the ticks of one family skip the blocks with no change since
+            const ChangeTicks &ticks = m_change_ticks[changed.front()];
+            for (size_t index = ticks.next(0, query.since); index != ChangeTicks::END; index = ticks.next(index + 1, query.since))
+            {
+                if (index >= m_entity_component_mask.size())
+                    break;
+                const ComponentMask &entity_mask = m_entity_component_mask[index];
+                if ((entity_mask & mask) == mask && (entity_mask & exclude).none() && changedSince(uint32_t(index), changed, query.since))
+                    invoke(f, Entity(this, createId(uint32_t(index))), uint32_t(index), uint32_t(index), pools, Indices());
+            }
+            return;
+        }
+        
+        const Group *group = groupOf(mask, exclude);
+        if (group)
+        {
+            const std::vector<uint32_t> &entities = group->entities();
+            size_t cursor = entities.size();
+            while (cursor > 0)
+            {
+                uint32_t index = entities[--cursor];
+                invoke(f, Entity(this, createId(index)), index, index, pools, Indices());
+                cursor = std::min(cursor, entities.size());
+            }
+            return;
+        }
+        
+        const std::vector<uint32_t> *packed = smallestPacked(mask);
+        if (packed)
+        {
+            // backward, so removing the current one is safe
+            size_t cursor = packed->size();
+            while (cursor > 0)
+            {
+                uint32_t index = (*packed)[--cursor];
+                if ((m_entity_component_mask[index] & mask) == mask && (m_entity_component_mask[index] & exclude).none())
+                    invoke(f, Entity(this, createId(index)), index, index, pools, Indices());
+                cursor = std::min(cursor, packed->size());
+            }
+            return;
+        }
+        
+        const uint32_t capacity = uint32_t(m_entity_component_mask.size());
+        // the bitmaps of the families, or of the entities alive for an empty mask, are
+        // intersected a block at a time, f may have changed the masks of the block since
+        BitmapScan scan = scanOf(mask, exclude, capacity);
+        for (size_t index = scan.next(); index != BitmapScan::END; index = scan.next())
+        {
+            if ((m_entity_component_mask[index] & mask) == mask && (m_entity_component_mask[index] & exclude).none() &&
+                (mask.any() || m_alive.test(index)))
+                invoke(f, Entity(this, createId(uint32_t(index))), uint32_t(index), uint32_t(index), pools, Indices());
+        }
+    }
+    
+    template <typename ... C_N, typename F>
+    void EntityManager::parallelEach(F f, size_t grain_size)
+    {
+        QueryMasks query;
+        Query<C_N...>::masks(this, query);
+        assert(query.changed.none());
+        parallelMatching(typename Query<C_N...>::Arguments(), query.mask, query.exclude, f, grain_size);
+    }
+    
+    template <typename ... Arguments, typename F>
+    void EntityManager::parallelMatching(TypeList<Arguments...>, const ComponentMask &mask, const ComponentMask &exclude, F &f, size_t grain_size)
+    {
+        typedef typename MakeIndexSequence<sizeof...(Arguments)>::type Indices;
+        
+        ThreadPool &thread_pool = m_thread_pool ? *m_thread_pool : ThreadPool::shared();
+        LockGuard lock(m_locked);
+        if (m_archetypes && (mask & ~m_tag_mask).any())
+        {
+            // a range for each chunk, the chunks are already a few KB
+            std::vector<std::pair<Archetype*, size_t>> chunks;
+            size_t cursor = 0;
+            while (Archetype *archetype = nextArchetype(mask, exclude, cursor))
+            {
+                for (size_t chunk = 0; chunk < archetype->chunks(); chunk++)
+                    chunks.push_back(std::make_pair(archetype, chunk));
+            }
+            const bool tags = ((mask | exclude) & m_tag_mask).any();
+            thread_pool.parallelFor(chunks.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++)
+                {
+                    Archetype *archetype = chunks[i].first;
+                    const size_t chunk = chunks[i].second;
+                    const std::vector<uint32_t> &entities = archetype->entities();
+                    std::tuple<typename QueryArgument<Arguments>::Column...> columns(QueryArgument<Arguments>::column(this, archetype, chunk)...);
+                    const size_t first = chunk * archetype->chunkCapacity();
+                    const size_t last = std::min(entities.size(), first + archetype->chunkCapacity());
+                    for (size_t row = first; row < last; row++)
+                    {
+                        uint32_t index = entities[row];
+                        if (tags && ((m_entity_component_mask[index] & mask) != mask || (m_entity_component_mask[index] & exclude).any()))
+                            continue;
+                        invoke(f, Entity(this, createId(index)), index, uint32_t(row - first), columns, Indices());
+                    }
+                }
+            });
+        }
+        else
+        {
+            std::tuple<typename QueryArgument<Arguments>::Pool...> pools(QueryArgument<Arguments>::pool(this)...);
+            const Group *group = groupOf(mask, exclude);
+            const size_t capacity = m_entity_component_mask.size();
+            if (group)
+            {
+                const std::vector<uint32_t> &entities = group->entities();
+                thread_pool.parallelFor(entities.size(), grain_size, [&](size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; i++)
+                        invoke(f, Entity(this, createId(entities[i])), entities[i], entities[i], pools, Indices());
+                });
+            }
+            else
+            {
+                // the ranges start at the words of the bitmaps, of the entities alive
+                // for an empty mask
+                const size_t words = (capacity + Bitmap::WORD_BITS - 1) / Bitmap::WORD_BITS;
+                thread_pool.parallelFor(words, (grain_size + Bitmap::WORD_BITS - 1) / Bitmap::WORD_BITS, [&](size_t begin, size_t end) {
+                    BitmapScan scan = scanOf(mask, exclude, std::min(capacity, end * Bitmap::WORD_BITS), begin * Bitmap::WORD_BITS);
+                    for (size_t index = scan.next(); index != BitmapScan::END; index = scan.next())
+                        invoke(f, Entity(this, createId(uint32_t(index))), uint32_t(index), uint32_t(index), pools, Indices());
+                });
+            }
+        }
+    }
+    
+    template <typename ... C_N, typename F>
+    void EntityManager::forEachChunk(F f)
+    {
+        QueryMasks query;
+        Query<C_N...>::masks(this, query);
+        assert(query.changed.none());
+        chunksMatching(typename Query<C_N...>::Arguments(), query.mask, query.exclude, f);
+    }
+    
+    template <typename ... Arguments, typename F>
+    void EntityManager::chunksMatching(TypeList<Arguments...> arguments, const ComponentMask &mask, const ComponentMask &exclude, F &f)
+    {
+        static_assert(sizeof...(Arguments) > 0, "no component to pass");
+        static_assert(std::is_same<BoolSequence<true, !IsTagComponent<Arguments>::value...>,
+                      BoolSequence<!IsTagComponent<Arguments>::value..., true>>::value, "the tags have no storage to span");
+        typedef typename MakeIndexSequence<sizeof...(Arguments)>::type Indices;
+        
+        std::vector<Entity::ID> ids;
+        if (m_archetypes)
+        {
+            // a chunk is a run, but the rows left out by the tags
+            const bool tags = (exclude & m_tag_mask).any();
+            size_t cursor = 0;
+            while (Archetype *archetype = nextArchetype(mask, exclude, cursor))
+            {
+                const std::vector<uint32_t> &entities = archetype->entities();
+                const size_t chunk_capacity = archetype->chunkCapacity();
+                for (size_t chunk = 0; chunk < archetype->chunks(); chunk++)
+                {
+                    std::tuple<typename QueryArgument<Arguments>::Column...> columns(QueryArgument<Arguments>::column(this, archetype, chunk)...);
+                    const size_t first = chunk * chunk_capacity;
+                    const size_t last = std::min(entities.size(), first + chunk_capacity);
+                    size_t row = first;
+                    while (row < last)
+                    {
+                        ids.clear();
+                        const size_t start = row;
+                        for (; row < last && !(tags && (m_entity_component_mask[entities[row]] & exclude).any()); row++)
+                            ids.push_back(createId(entities[row]));
+                        if (row > start)
+                            invokeSpans(f, ids, entities[start], uint32_t(start - first), row - start, columns, arguments, Indices());
+                        // skip the row left out
+                        row++;
+                    }
+                }
+            }
+            return;
+        }
+        
+        // the matches in order, a run ends where a component is not next to the previous one
+        std::tuple<typename QueryArgument<Arguments>::Pool...> pools(QueryArgument<Arguments>::pool(this)...);
+        BitmapScan scan = scanOf(mask, exclude, m_entity_component_mask.size());
+        size_t next = scan.next();
+        while (next != BitmapScan::END)
+        {
+            const uint32_t start = uint32_t(next);
+            ids.clear();
+            do {
+                ids.push_back(createId(uint32_t(next)));
+                next = scan.next();
+            } while (next != BitmapScan::END && next == start + ids.size() &&
+                     contiguous(pools, start, ids.size(), uint32_t(next), Indices()));
+            invokeSpans(f, ids, start, start, ids.size(), pools, arguments, Indices());
+        }
     }
     
     template <typename ComponentType, typename ContainerType>
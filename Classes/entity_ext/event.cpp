@@ -11,87 +11,220 @@ warranty, and with no claim as to its suitability for any purpose.
 
 */
 #include "event.h"
+#include "entity.hpp"
+#include <algorithm>
+#include <cassert>
 
 namespace ECS
 {
+	EventBase::Family EventBase::s_family_counter = 0;
+	EventSystem::Family EventSystem::s_receiver_family_counter = 0;
+
 	bool RequireComponentDecorateBase::isValidFor(Entity entity) const {
 		if (m_base)
 			return m_base->isValidFor(entity);
 		return false;
 	}
 
+	bool RequireComponentDecorateBase::lowerDecorated(std::vector<Clause> &clauses) const {
+		if (m_base)
+			return m_base->lower(clauses);
+		return true;
+	}
+
 	EventSystem::EventSystem() {
 	}
 
 	EventSystem::~EventSystem() {
 	}
 
-	void EventSystem::sendConsumed(Entity entity, AbstractEventConsumble *evt, ReceiverList &list) {
-		for (auto receiver : list) {
-			if (receiver)
-				receiver->process(entity, evt);
+	bool EventSystem::isDeliverable(Entity entity) {
+		return entity.id() == Entity::INVALID || entity.valid();
+	}
 
-			if (evt->isConsumed())
-				return;
+	bool EventSystem::isValidFor(const Target &target, Entity entity, RequireComponentBase::ComponentMask &mask, bool &masked) {
+		switch (target.check) {
+		case Target::CHECK_NONE:
+			return true;
+		case Target::CHECK_VIRTUAL: {
+			// the entity may be gone by a flush
+			EntityManager *manager = entity.getManager();
+			return manager && manager->valid(entity.id()) && target.requirement->isValidFor(entity);
+		}
+		default:
+			break;
+		}
+		if (!masked) {
+			EntityManager *manager = entity.getManager();
+			if (manager && manager->valid(entity.id()))
+				mask = manager->componentMask(entity.id());
+			masked = true;
+		}
+		for (auto &clause : target.clauses) {
+			if (clause.matches(mask))
+				return true;
 		}
+		return false;
 	}
 
-	void EventSystem::sendNormal(Entity entity, EventBase *evt, ReceiverList &list) {
-		for (auto receiver : list) {
-			if (receiver)
-				receiver->process(entity, evt);
+	void EventSystem::sendConsumed(Entity entity, AbstractEventConsumble *evt, const Dispatch &dispatch) {
+		RequireComponentBase::ComponentMask mask;
+		bool masked = false;
+		for (auto &bucket : dispatch.buckets) {
+			for (auto &target : bucket) {
+				if (!isValidFor(target, entity, mask, masked))
+					continue;
+				target.delegate(entity, evt);
+				masked = false;
+
+				if (evt->isConsumed())
+					return;
+			}
 		}
 	}
 
-	void EventSystem::addReceiver(uint32_t familyEvent, uint32_t familyReceiver, EventReceiverPtr receiver) {
-		auto it = m_receivers.find(familyEvent);
-
-		if (it == m_receivers.end()) {
-			m_receivers.insert(std::make_pair(familyEvent, ReceiverStore()));
-			it = m_receivers.find(familyEvent);
+	void EventSystem::sendNormal(Entity entity, EventBase *evt, const Dispatch &dispatch) {
+		RequireComponentBase::ComponentMask mask;
+		bool masked = false;
+		for (auto &bucket : dispatch.buckets) {
+			for (auto &target : bucket) {
+				if (isValidFor(target, entity, mask, masked)) {
+					target.delegate(entity, evt);
+					masked = false;
+				}
+			}
 		}
+	}
 
-		if (it != m_receivers.end()) {
-			it->second[familyReceiver] = receiver;
+	void EventSystem::addReceiver(Family familyEvent, Family familyReceiver, EventBase::Priority priority,
+		const EventDelegate &delegate, RequireComponentBase *requirement) {
+		if (m_dispatch.size() <= familyEvent)
+			m_dispatch.resize(familyEvent + 1);
+		if (!m_dispatch[familyEvent])
+			m_dispatch[familyEvent] = std::unique_ptr<Dispatch>(new Dispatch());
+		Dispatch &dispatch = *m_dispatch[familyEvent];
+
+		auto it = std::find_if(dispatch.receivers.begin(), dispatch.receivers.end(),
+			[familyReceiver](const Registered &entry) { return entry.family == familyReceiver; });
+		// the requirement is lowered once, here
+		Registered registered;
+		registered.family = familyReceiver;
+		registered.priority = priority;
+		registered.requirement = std::unique_ptr<RequireComponentBase>(requirement);
+		registered.target.delegate = delegate;
+		registered.target.requirement = requirement;
+		if (requirement)
+			registered.target.check = requirement->lower(registered.target.clauses) ? Target::CHECK_MASKS : Target::CHECK_VIRTUAL;
+		if (it == dispatch.receivers.end()) {
+			dispatch.receivers.push_back(std::move(registered));
+		}
+		else {
+			if (m_sending)
+				m_retired.push_back(std::move(it->requirement));
+			*it = std::move(registered);
 		}
+		rebuild(dispatch);
 	}
 
-	void EventSystem::removeReceiver(uint32_t familyEvent, uint32_t familyReceiver) {
-		auto it = m_receivers.find(familyEvent);
+	void EventSystem::removeReceiver(Family familyEvent, Family familyReceiver) {
+		if (familyEvent >= m_dispatch.size() || !m_dispatch[familyEvent])
+			return;
+		Dispatch &dispatch = *m_dispatch[familyEvent];
+
+		auto it = std::find_if(dispatch.receivers.begin(), dispatch.receivers.end(),
+			[familyReceiver](const Registered &entry) { return entry.family == familyReceiver; });
+		if (it == dispatch.receivers.end())
+			return;
+		if (m_sending)
+			m_retired.push_back(std::move(it->requirement));
+		dispatch.receivers.erase(it);
+		rebuild(dispatch);
+	}
 
-		if (it != m_receivers.end()) {
-			it->second.erase(familyReceiver);
+	void EventSystem::rebuild(Dispatch &dispatch) {
+		if (m_sending) {
+			dispatch.dirty = m_dirty = true;
+			return;
 		}
+		dispatch.dirty = false;
+		for (auto &bucket : dispatch.buckets)
+			bucket.clear();
+		for (auto &registered : dispatch.receivers)
+			dispatch.buckets[registered.priority].push_back(registered.target);
 	}
 
-	void EventSystem::sendInner(Entity entity, uint32_t familyEvent, EventBase * evt) {
-		ReceiverList list;
-		getValidReceiversFor(entity, familyEvent, list);
-		auto consumble = dynamic_cast<AbstractEventConsumble*>(evt);
+	void EventSystem::sendInner(Entity entity, Family familyEvent, EventBase * evt, AbstractEventConsumble *consumble) {
+		if (familyEvent >= m_dispatch.size() || !m_dispatch[familyEvent])
+			return;
+		const Dispatch &dispatch = *m_dispatch[familyEvent];
+
+		m_sending++;
 		if (consumble) {
 			consumble->reset();
-			sendConsumed(entity, consumble, list);
+			sendConsumed(entity, consumble, dispatch);
 		}
 		else {
-			sendNormal(entity, evt, list);
+			sendNormal(entity, evt, dispatch);
+		}
+		endSend();
+	}
+
+	void EventSystem::endSend() {
+		if (--m_sending || !m_dirty)
+			return;
+
+		m_dirty = false;
+		m_retired.clear();
+		for (auto &dispatch : m_dispatch) {
+			if (dispatch && dispatch->dirty)
+				rebuild(*dispatch);
+		}
+	}
+
+	void EventSystem::flush() {
+		flushQueues(false, Clock::time_point());
+	}
+
+	bool EventSystem::flush(std::chrono::steady_clock::duration budget) {
+		return flushQueues(true, Clock::now() + budget);
+	}
+
+	size_t EventSystem::queued() const {
+		size_t count = 0;
+		for (auto &queue : m_queues) {
+			if (queue)
+				count += queue->size();
 		}
+		return count;
 	}
 
-	class CompairReceiver {
-	public:
-		bool operator () (EventReceiverPtr r1, EventReceiverPtr r2) {
-			return r2->getPriority() > r1->getPriority();
+	bool EventSystem::flushQueues(bool limited, Clock::time_point deadline) {
+		assert(!m_flushing);
+		m_flushing = true;
+		m_sending++;
+		for (auto &queue : m_queues) {
+			if (queue)
+				queue->take();
 		}
-	};
-
-	void EventSystem::getValidReceiversFor(Entity entity, uint32_t familyEvent, ReceiverList & list) {
-		auto it = m_receivers.find(familyEvent);
-		if (it != m_receivers.end()) {
-			for (auto &receiver : it->second) {
-				if (receiver.second.get() && receiver.second->isValidFor(entity))
-					list.push_back(receiver.second);
+
+		// the receivers may enqueue or register new event types, the queues and
+		// the dispatches are taken by their index
+		bool done = true;
+		bool delivered = false;
+		for (size_t family = 0; family < m_queues.size() && done; family++) {
+			BaseQueue *queue = m_queues[family].get();
+			if (!queue || !queue->size())
+				continue;
+			if (limited && delivered && Clock::now() >= deadline) {
+				done = false;
+				break;
 			}
+			const Dispatch *dispatch = family < m_dispatch.size() ? m_dispatch[family].get() : nullptr;
+			done = queue->deliver(dispatch, limited, deadline);
+			delivered = true;
 		}
-		std::sort(list.begin(), list.end(), CompairReceiver());
+		m_flushing = false;
+		endSend();
+		return done;
 	}
 }
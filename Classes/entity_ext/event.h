@@ -4,10 +4,15 @@
 #include <cstdint>
 #include <cstddef>
 #include <vector>
+#include <bitset>
 #include <list>
-#include <unordered_map>
 #include <memory>
+#include <cstring>
+#include <type_traits>
 #include <utility>
+#include <algorithm>
+#include <chrono>
+#include <iterator>
 #include "entity.h"
 
 namespace ECS {
@@ -24,12 +29,29 @@ namespace ECS {
 			PRIORITY_COUNT
 		};
 
+		typedef size_t Family;
+
 	public:
 		virtual ~EventBase() {}
 
 		virtual std::string getName() const = 0;
+
+		static Family s_family_counter;
+	};
+
+	// a dense id for each event type, the events need not derive from it
+	template <typename Derived>
+	class Event : public EventBase {
+	public:
+		static Family family();
 	};
 
+	template <typename Derived>
+	EventBase::Family Event<Derived>::family() {
+		static Family family = s_family_counter++;
+		return family;
+	}
+
 	class EventConsumble : public EventBase
 	{
 	public:
@@ -51,26 +73,96 @@ namespace ECS {
 		bool m_consumed = false;
 	};
 
-	class EventReceiverBase
+	/**
+	* a receiver call held by value: the object, the function it calls stored inline,
+	* and a thunk restoring their types. no allocation, no virtual call
+	*/
+	class EventDelegate
 	{
 	public:
-		virtual ~EventReceiverBase() {}
-        
-		virtual void process(Entity entity, EventBase *evt) = 0;
-		virtual bool isValidFor(Entity entity) const = 0;
-		virtual EventBase::Priority getPriority() const = 0;
-	};
+		EventDelegate() {}
 
-	typedef std::shared_ptr<EventReceiverBase> EventReceiverPtr;
+		template <typename Receiver, typename E>
+		static EventDelegate bind(Receiver *receiver, void (Receiver::*receive)(Entity entity, E &evt)) {
+			typedef void (Receiver::*Method)(Entity entity, E &evt);
+			static_assert(sizeof(Method) <= STORAGE_SIZE, "the member function pointer does not fit");
+			EventDelegate delegate;
+			delegate.m_object = receiver;
+			std::memcpy(delegate.m_storage, &receive, sizeof(Method));
+			delegate.m_thunk = &callMethod<Receiver, E>;
+			return delegate;
+		}
+
+		template <typename E>
+		static EventDelegate bind(void (*func)(Entity entity, E &evt)) {
+			typedef void (*Function)(Entity entity, E &evt);
+			EventDelegate delegate;
+			std::memcpy(delegate.m_storage, &func, sizeof(Function));
+			delegate.m_thunk = &callFunction<E>;
+			return delegate;
+		}
+
+		explicit operator bool() const { return m_thunk != nullptr; }
+
+		void operator () (Entity entity, EventBase *evt) const {
+			m_thunk(*this, entity, evt);
+		}
+
+	private:
+		static const size_t STORAGE_SIZE = 4 * sizeof(void*);
+
+		template <typename Receiver, typename E>
+		static void callMethod(const EventDelegate &delegate, Entity entity, EventBase *evt) {
+			void (Receiver::*receive)(Entity entity, E &evt);
+			std::memcpy(&receive, delegate.m_storage, sizeof(receive));
+			(static_cast<Receiver*>(delegate.m_object)->*receive)(entity, *static_cast<E*>(evt));
+		}
+
+		template <typename E>
+		static void callFunction(const EventDelegate &delegate, Entity entity, EventBase *evt) {
+			void (*func)(Entity entity, E &evt);
+			std::memcpy(&func, delegate.m_storage, sizeof(func));
+			func(entity, *static_cast<E*>(evt));
+		}
+
+		void *m_object = nullptr;
+		alignas(void*) unsigned char m_storage[STORAGE_SIZE];
+		void (*m_thunk)(const EventDelegate &delegate, Entity entity, EventBase *evt) = nullptr;
+	};
 
 	class RequireComponentBase
 	{
+	public:
+		typedef std::bitset<MAX_COMPONENTS> ComponentMask;
+
+		// all the components of all, and one of any unless it is empty
+		struct Clause {
+			ComponentMask all;
+			ComponentMask any;
+
+			bool matches(const ComponentMask &mask) const {
+				return (mask & all) == all && (any.none() || (mask & any).any());
+			}
+		};
+
 	public:
 		virtual ~RequireComponentBase() {}
 
 		virtual bool isValidFor(Entity entity) const = 0;
+
+		// append the clauses one of which the entity must match, false when the
+		// requirement is not told by the components, isValidFor is then called
+		virtual bool lower(std::vector<Clause> &clauses) const { return false; }
 	};
 
+	template <typename ... Components>
+	RequireComponentBase::ComponentMask requiredMask() {
+		RequireComponentBase::ComponentMask mask;
+		int expand[] = { 0, (mask.set(Component<typename std::remove_const<Components>::type>::family()), 0)... };
+		(void)expand;
+		return mask;
+	}
+
 	// for the dynamic configuration based requirements
 	class RequireComponentDecorateBase : public RequireComponentBase
 	{
@@ -82,6 +174,11 @@ namespace ECS {
 
         bool isValidFor(Entity entity) const;
 
+	protected:
+		// the clauses of the requirement decorated, none when there is none.
+		// a subclass lowers only the conditions it knows, the others may add their own
+		bool lowerDecorated(std::vector<Clause> &clauses) const;
+
 	private:
 		std::unique_ptr<RequireComponentBase> m_base;
 	};
@@ -96,6 +193,13 @@ namespace ECS {
         bool isValidFor(Entity entity) const {
             return entity.hasComponentOr<Components ...>() || RequireComponentDecorateBase::isValidFor(entity);
         }
+
+		bool lower(std::vector<Clause> &clauses) const {
+			Clause clause;
+			clause.any = requiredMask<Components...>();
+			clauses.push_back(clause);
+			return lowerDecorated(clauses);
+		}
 	};
     
 	template <typename ... Components>
@@ -105,47 +209,15 @@ namespace ECS {
         bool isValidFor(Entity entity) const {
             return entity.hasComponent<Components ...>();
         }
-	};
-
-	template <typename E>
-	class EventReceiver : public EventReceiverBase
-	{
-	public:
-		EventReceiver(EventBase::Priority priority, 
-			std::function<void(Entity entity, E &evt)> call, RequireComponentBase *requirement = nullptr)
-			: m_priority(priority)
-			, m_call(call)
-			, m_requirement(requirement)
-		{
-		}
-
-		~EventReceiver() {
-
-		}
-
-        virtual void process(Entity entity, EventBase *evt) {
-            if (m_call && evt)
-                m_call(entity, *(static_cast<E*>(evt)));
-        }
 
-        virtual bool isValidFor(Entity entity) const {
-            if (m_requirement)
-                return m_requirement->isValidFor(entity);
-            return true;
-        }
-
-		virtual EventBase::Priority getPriority() const
-		{
-			return m_priority;
+		bool lower(std::vector<Clause> &clauses) const {
+			Clause clause;
+			clause.all = requiredMask<Components...>();
+			clauses.push_back(clause);
+			return true;
 		}
-
-	private:
-		EventBase::Priority m_priority;
-		std::function<void(Entity entity, E &evt)> m_call;
-		std::unique_ptr<RequireComponentBase> m_requirement;
 	};
-    
-       
+
 	class EventSystem {
 	public:
 		EventSystem();
@@ -154,49 +226,241 @@ namespace ECS {
 		template <typename Receiver, typename E>
 		void registerEventReceiver(EventBase::Priority priority, Receiver &receiver, E &e, void(Receiver::*receive)(Entity entity, E &evt), RequireComponentBase * requirement = nullptr)
 		{
-			auto wrapper = EventReceiverPtr(static_cast<EventReceiverBase*>(new EventReceiver<E>(priority,
-				std::bind(receive, &receiver, std::placeholders::_1, std::placeholders::_2), requirement)));
-			addReceiver((uint32_t)typeid(E).hash_code(),(uint32_t)typeid(Receiver).hash_code(), wrapper);
+			addReceiver(Event<E>::family(), receiverFamily<Receiver>(), priority,
+				EventDelegate::bind(&receiver, receive), requirement);
 		}
 
 		template <typename Receiver, typename E>
 		void registerEventReceiver(EventBase::Priority priority, Receiver &receiver, E &e, void(*func)(Entity entity, E &e), RequireComponentBase * requirement = nullptr)
 		{
-			auto wrapper = EventReceiverPtr(static_cast<EventReceiverBase*>(new EventReceiver<E>(priority,
-				func, requirement)));
-			addReceiver(typeid(E).hash_code(), typeid(Receiver).hash_code(), wrapper);
+			addReceiver(Event<E>::family(), receiverFamily<Receiver>(), priority,
+				EventDelegate::bind(func), requirement);
 		}
 
 		template <typename Receiver, typename E>
 		void unregisterEventReceiver()
 		{
-			removeReceiver(typeid(E).hash_code(), typeid(Receiver).hash_code());
+			removeReceiver(Event<E>::family(), receiverFamily<Receiver>());
 		}
 
+		// whether the event is consumable is told by its type
 		template <typename E>
         void send(Entity entity, E &e) {
-            sendInner(entity, (uint32_t)typeid(e).hash_code(), &e);
+            sendInner(entity, Event<E>::family(), &e, consumable(&e, std::is_base_of<AbstractEventConsumble, E>()));
         }
 
+		// keep the event for the next flush, with the others of its type
+		template <typename E>
+		void enqueue(Entity entity, E &&e);
+
+		// deliver the events enqueued, type by type, each batch of events to one
+		// receiver after another in the order of the priorities. the events enqueued
+		// by the receivers wait for the next flush
+		void flush();
+
+		// flush until the budget is spent, a batch at least, the events left are
+		// delivered first by the next flush. true when none is left
+		bool flush(std::chrono::steady_clock::duration budget);
+
+		// the events waiting for a flush
+		size_t queued() const;
+
 	private:
-		typedef std::vector<EventReceiverPtr> ReceiverList;
-		typedef std::unordered_map<uint32_t, EventReceiverPtr> ReceiverStore;
+		typedef EventBase::Family Family;
+
+		// a receiver with its requirement lowered to masks
+		struct Target {
+			enum Check {
+				CHECK_NONE,
+				CHECK_MASKS,
+				CHECK_VIRTUAL
+			};
+
+			EventDelegate delegate;
+			Check check = CHECK_NONE;
+			const RequireComponentBase *requirement = nullptr;
+			std::vector<RequireComponentBase::Clause> clauses;
+		};
+
+		// the receivers of an event type, by receiver type in the order registered, and
+		// bucketed by priority, rebuilt when they change, so a send walks them without
+		// copying or sorting
+		struct Registered {
+			Family family;
+			EventBase::Priority priority;
+			std::unique_ptr<RequireComponentBase> requirement;
+			Target target;
+		};
+
+		struct Dispatch {
+			std::vector<Registered> receivers;
+			std::vector<Target> buckets[EventBase::PRIORITY_COUNT];
+			bool dirty = false;
+		};
+
+		// a dense id for each receiver type
+		template <typename Receiver>
+		static Family receiverFamily() {
+			static Family family = s_receiver_family_counter++;
+			return family;
+		}
+
+		static Family s_receiver_family_counter;
+
+		typedef std::chrono::steady_clock Clock;
+
+		// the events of a type waiting for a flush, kept by value and contiguous,
+		// the storage is reused from a frame to the next
+		class BaseQueue {
+		public:
+			virtual ~BaseQueue() {}
+
+			// the events enqueued since the last flush go after the ones it left
+			virtual void take() = 0;
+
+			// the events taken a batch at a time, until the deadline if limited,
+			// true when none is left
+			virtual bool deliver(const Dispatch *dispatch, bool limited, Clock::time_point deadline) = 0;
+
+			virtual size_t size() const = 0;
+		};
+
+		template <typename E>
+		class Queue : public BaseQueue {
+		public:
+			static const size_t BATCH_SIZE = 64;
+
+			void push(Entity entity, E &&e) {
+				m_pending.push_back(std::move(e));
+				m_pending_entities.push_back(entity);
+			}
+
+			void take() {
+				if (m_head) {
+					m_events.erase(m_events.begin(), m_events.begin() + m_head);
+					m_entities.erase(m_entities.begin(), m_entities.begin() + m_head);
+					m_head = 0;
+				}
+				std::move(m_pending.begin(), m_pending.end(), std::back_inserter(m_events));
+				m_entities.insert(m_entities.end(), m_pending_entities.begin(), m_pending_entities.end());
+				m_pending.clear();
+				m_pending_entities.clear();
+			}
+
+			bool deliver(const Dispatch *dispatch, bool limited, Clock::time_point deadline) {
+				while (m_head < m_events.size()) {
+					size_t end = std::min(m_events.size(), m_head + BATCH_SIZE);
+					if (dispatch)
+						deliverBatch(*dispatch, m_head, end);
+					m_head = end;
+					if (limited && Clock::now() >= deadline)
+						break;
+				}
+				if (m_head < m_events.size())
+					return false;
+				m_events.clear();
+				m_entities.clear();
+				m_head = 0;
+				return true;
+			}
+
+			size_t size() const {
+				return m_events.size() - m_head + m_pending.size();
+			}
+
+		private:
+			void deliverBatch(const Dispatch &dispatch, size_t begin, size_t end) {
+				typedef std::is_base_of<AbstractEventConsumble, E> Consumable;
+				for (size_t i = begin; i < end; i++) {
+					AbstractEventConsumble *consumble = consumable(&m_events[i], Consumable());
+					if (consumble)
+						consumble->reset();
+				}
+				for (auto &bucket : dispatch.buckets) {
+					for (auto &target : bucket) {
+						for (size_t i = begin; i < end; i++) {
+							AbstractEventConsumble *consumble = consumable(&m_events[i], Consumable());
+							if (consumble && consumble->isConsumed())
+								continue;
+							if (!isDeliverable(m_entities[i]))
+								continue;
+							// a receiver may change any entity of the batch, the mask is taken each time
+							RequireComponentBase::ComponentMask mask;
+							bool masked = false;
+							if (isValidFor(target, m_entities[i], mask, masked))
+								target.delegate(m_entities[i], &m_events[i]);
+						}
+					}
+				}
+			}
+
+			std::vector<E> m_events;
+			std::vector<Entity> m_entities;
+			// the events before are delivered
+			size_t m_head = 0;
+			// enqueued since the last flush
+			std::vector<E> m_pending;
+			std::vector<Entity> m_pending_entities;
+		};
 
 	private:
-		void addReceiver(uint32_t familyEvent, uint32_t familyReceiver, EventReceiverPtr receiver);
+		void addReceiver(Family familyEvent, Family familyReceiver, EventBase::Priority priority,
+			const EventDelegate &delegate, RequireComponentBase *requirement);
+
+		void removeReceiver(Family familyEvent, Family familyReceiver);
+
+		// deferred while sending, the buckets walked must stay as they are
+		void rebuild(Dispatch &dispatch);
 
-		void removeReceiver(uint32_t familyEvent, uint32_t familyReceiver);
+		template <typename E>
+		static AbstractEventConsumble *consumable(E *evt, std::true_type) { return evt; }
+
+		template <typename E>
+		static AbstractEventConsumble *consumable(E *evt, std::false_type) { return nullptr; }
 
-		void sendInner(Entity entity, uint32_t familyEvent, EventBase *evt);
+		// consumable is evt when it is one, else nullptr
+		void sendInner(Entity entity, Family familyEvent, EventBase *evt, AbstractEventConsumble *consumable);
 
-		void getValidReceiversFor(Entity entity, uint32_t familyEvent, ReceiverList &list);
+		// the mask of the entity is taken once for the receivers skipped, and again
+		// after a receiver is called, which may have changed the entity
+		static bool isValidFor(const Target &target, Entity entity, RequireComponentBase::ComponentMask &mask, bool &masked);
 
-		void sendConsumed(Entity entity, AbstractEventConsumble *evt, ReceiverList &list);
+		// the entity of a queued event may be gone by the flush, whatever the receiver,
+		// the events sent to no entity are delivered
+		static bool isDeliverable(Entity entity);
 
-		void sendNormal(Entity entity, EventBase *evt, ReceiverList &list);
+		void sendConsumed(Entity entity, AbstractEventConsumble *evt, const Dispatch &dispatch);
+
+		void sendNormal(Entity entity, EventBase *evt, const Dispatch &dispatch);
+
+		// the changes made by the receivers, once no send is in progress
+		void endSend();
+
+		bool flushQueues(bool limited, Clock::time_point deadline);
 
 	private:
-		std::unordered_map<uint32_t, ReceiverStore> m_receivers;
+		// by event family, they do not move when a receiver registers during a send
+		std::vector<std::unique_ptr<Dispatch>> m_dispatch;
+		// the sends in progress
+		uint32_t m_sending = 0;
+		bool m_dirty = false;
+		// the requirements of the receivers removed while sending, alive until the sends are done
+		std::vector<std::unique_ptr<RequireComponentBase>> m_retired;
+		// the events enqueued, by event family
+		std::vector<std::unique_ptr<BaseQueue>> m_queues;
+		bool m_flushing = false;
 	};
+
+	template <typename E>
+	void EventSystem::enqueue(Entity entity, E &&e) {
+		typedef typename std::decay<E>::type Type;
+		Family family = Event<Type>::family();
+		if (m_queues.size() <= family)
+			m_queues.resize(family + 1);
+		if (!m_queues[family])
+			m_queues[family] = std::unique_ptr<BaseQueue>(new Queue<Type>());
+		Type evt(std::forward<E>(e));
+		static_cast<Queue<Type>*>(m_queues[family].get())->push(entity, std::move(evt));
+	}
 }
 #endif
@@ -38,6 +38,14 @@ namespace ECS {
 		return std::string("BeforeRemoveEntity");
 	}
 
+	BeforeRemoveEntities::BeforeRemoveEntities(const Entity::ID *ids, size_t count)
+		: m_ids(ids), m_count(count) {
+	}
+
+	std::string BeforeRemoveEntities::getName() const {
+		return std::string("BeforeRemoveEntities");
+	}
+
 	AfterEntityCreated * AfterEntityCreated::getInstance() {
 		static AfterEntityCreated *sInstance = nullptr;
 		if (!sInstance) {
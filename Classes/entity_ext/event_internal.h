@@ -43,6 +43,23 @@ namespace ECS {
 		std::string getName() const;
 	};
 
+	// sent once by EntityManager::destroyMany, for the entities destroyed together
+	class BeforeRemoveEntities : public EventBase
+	{
+	public:
+		BeforeRemoveEntities(const Entity::ID *ids, size_t count);
+
+		std::string getName() const;
+
+		const Entity::ID *ids() const { return m_ids; }
+
+		size_t count() const { return m_count; }
+
+	private:
+		const Entity::ID *m_ids;
+		size_t m_count;
+	};
+
 	class BeforeRemoveComponent : public EventBase
 	{
 	public:
@@ -0,0 +1,17 @@
+/*
+
+the group keeps the entities matching a component mask
+
+Author:  yukun tan (codecraft@163.com)
+
+(C) Copyright tanyukun 2015. Permission to copy, use, modify, sell and
+distribute this software is granted provided this copyright notice appears
+in all copies. This software is provided "as is" without express or implied
+warranty, and with no claim as to its suitability for any purpose.
+
+*/
+#include "group.h"
+
+namespace ECS {
+	const uint32_t Group::INVALID;
+}
@@ -0,0 +1,192 @@
+#ifndef _GROUP_H_
+#define _GROUP_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <bitset>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include "component.h"
+#include "../tool/bitmap.h"
+
+namespace ECS {
+	/**
+	* the entities having all the components of a mask and none of an exclude mask,
+	* kept up to date by the EntityManager on every structural change, so a view
+	* over it costs the matches only
+	*/
+	class Group {
+	public:
+		typedef std::bitset<MAX_COMPONENTS> ComponentMask;
+
+		static const uint32_t INVALID = ~0U;
+
+		explicit Group(const ComponentMask &mask, const ComponentMask &exclude = ComponentMask())
+			: m_mask(mask), m_exclude(exclude) {}
+
+		const ComponentMask &mask() const { return m_mask; }
+		const ComponentMask &exclude() const { return m_exclude; }
+
+		// the entity indices, in no order
+		const std::vector<uint32_t> &entities() const { return m_entities; }
+
+		size_t size() const { return m_entities.size(); }
+
+		bool contains(uint32_t index) const {
+			return index < m_positions.size() && m_positions[index] != INVALID;
+		}
+
+		inline bool matches(const ComponentMask &mask) const {
+			return (mask & m_mask) == m_mask && (mask & m_exclude).none();
+		}
+
+		// the mask of the entity changed from before to after
+		inline void update(uint32_t index, const ComponentMask &before, const ComponentMask &after) {
+			bool was = matches(before);
+			bool is = matches(after);
+			if (was == is)
+				return;
+			if (is)
+				insert(index);
+			else
+				erase(index);
+		}
+
+		void insert(uint32_t index) {
+			if (m_positions.size() <= index)
+				m_positions.resize(index + 1, INVALID);
+			m_positions[index] = uint32_t(m_entities.size());
+			m_entities.push_back(index);
+		}
+
+		// the last one takes the hole
+		void erase(uint32_t index) {
+			uint32_t position = m_positions[index];
+			uint32_t last = m_entities.back();
+			m_entities[position] = last;
+			m_positions[last] = position;
+			m_entities.pop_back();
+			m_positions[index] = INVALID;
+		}
+
+		// the entity from takes the index to
+		void relocate(uint32_t from, uint32_t to) {
+			if (!contains(from))
+				return;
+			if (m_positions.size() <= to)
+				m_positions.resize(to + 1, INVALID);
+			uint32_t position = m_positions[from];
+			m_entities[position] = to;
+			m_positions[to] = position;
+			m_positions[from] = INVALID;
+		}
+
+		void shrink(size_t n) {
+			if (n < m_positions.size())
+				m_positions.resize(n);
+			m_positions.shrink_to_fit();
+		}
+
+		void clear() {
+			m_entities.clear();
+			m_positions.clear();
+		}
+
+	private:
+		ComponentMask m_mask;
+		ComponentMask m_exclude;
+		std::vector<uint32_t> m_entities;
+		std::vector<uint32_t> m_positions;
+	};
+
+	/**
+	* the entities with a component, in the order of a key of it. the order is kept
+	* from a sort to the next, so the next one repairs an almost sorted list
+	*/
+	class SortedGroup {
+	public:
+		// the entity indices, in order
+		const std::vector<uint32_t> &entities() const { return m_entities; }
+
+		// drop the entities without the component any more
+		void retain(const Bitmap &family) {
+			size_t kept = 0;
+			for (uint32_t index : m_entities) {
+				if (family.test(index))
+					m_entities[kept++] = index;
+				else
+					m_members.reset(index);
+			}
+			m_entities.resize(kept);
+		}
+
+		// retain, then append the new ones
+		// @return the count of the entities kept, in front
+		size_t update(const Bitmap &family, size_t limit) {
+			retain(family);
+			size_t kept = m_entities.size();
+			BitmapScan scan(std::vector<const Bitmap*>(1, &family), std::vector<const Bitmap*>(1, &m_members), limit);
+			for (size_t index = scan.next(); index != BitmapScan::END; index = scan.next()) {
+				m_entities.push_back(uint32_t(index));
+				m_members.set(index);
+			}
+			return kept;
+		}
+
+		// @param keys the key of each entity and the entity, in the order of entities()
+		// @param kept the count of the entities sorted before
+		template <typename Key>
+		void sort(std::vector<std::pair<Key, uint32_t>> &keys, size_t kept) {
+			typedef std::pair<Key, uint32_t> Entry;
+			auto less = [](const Entry &a, const Entry &b) { return a.first < b.first; };
+
+			// the ones kept are almost in order, only the keys changed move
+			for (size_t i = 1; i < kept; i++) {
+				if (!less(keys[i], keys[i - 1]))
+					continue;
+				Entry entry = std::move(keys[i]);
+				size_t j = i;
+				for (; j > 0 && less(entry, keys[j - 1]); j--)
+					keys[j] = std::move(keys[j - 1]);
+				keys[j] = std::move(entry);
+			}
+			// the new ones are sorted apart, then merged in
+			if (kept < keys.size()) {
+				std::stable_sort(keys.begin() + kept, keys.end(), less);
+				std::inplace_merge(keys.begin(), keys.begin() + kept, keys.end(), less);
+			}
+
+			for (size_t i = 0; i < keys.size(); i++)
+				m_entities[i] = keys[i].second;
+		}
+
+		// the entities moved by a compact, sorted by from, after a retain
+		void remap(const std::vector<std::pair<uint32_t, uint32_t>> &moves) {
+			for (uint32_t &index : m_entities) {
+				auto found = std::lower_bound(moves.begin(), moves.end(), std::make_pair(index, 0U));
+				if (found != moves.end() && found->first == index) {
+					m_members.reset(index);
+					index = found->second;
+					m_members.set(index);
+				}
+			}
+		}
+
+		void shrink(size_t n) {
+			m_members.shrink(n);
+		}
+
+		void clear() {
+			m_entities.clear();
+			m_members.clear();
+		}
+
+	private:
+		std::vector<uint32_t> m_entities;
+		// the entities in the list
+		Bitmap m_members;
+	};
+}
+
+#endif
@@ -50,6 +50,16 @@ namespace ECS {
 		void serialize(Entity source, const std::string &key);
 
 		void unserialize(Entity source, const std::string &key);
+
+	private:
+		// a tag has no data of its own, only the instance shared by all the entities
+		typedef std::integral_constant<bool, IsTagComponent<ComponentType>::value> Tag;
+
+		void parse(std::istream &in, Entity dest, std::false_type);
+		void parse(std::istream &in, Entity dest, std::true_type) {}
+
+		void clone(Entity source, Entity dest, std::false_type);
+		void clone(Entity source, Entity dest, std::true_type) { dest.assignComponent<ComponentType>(); }
 	};
     
     template <typename ComponentType>
@@ -66,6 +76,11 @@ namespace ECS {
 
 	template <typename ComponentType>
 	void SerializerImpl<ComponentType>::parse(std::istream &in, Entity dest) {
+		parse(in, dest, Tag());
+	}
+
+	template <typename ComponentType>
+	void SerializerImpl<ComponentType>::parse(std::istream &in, Entity dest, std::false_type) {
 		auto com = dest.getComponent<ComponentType>();
 		if (com) {
 			rpocojson::parse(in, *com.get());
@@ -74,6 +89,11 @@ namespace ECS {
 
 	template <typename ComponentType>
 	void SerializerImpl<ComponentType>::clone(Entity source, Entity dest) {
+		clone(source, dest, Tag());
+	}
+
+	template <typename ComponentType>
+	void SerializerImpl<ComponentType>::clone(Entity source, Entity dest, std::false_type) {
 		auto com = source.getComponent<ComponentType>().get();
 		dest.assignComponentFrom<ComponentType>(*com);
 	}
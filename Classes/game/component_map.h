@@ -2,6 +2,7 @@
 #define _COMPONENT_MAP_H_
 
 #include "../tool/rpoco.hpp"
+#include "../entity_ext/component.h"
 
 namespace Arcane {
 
@@ -13,4 +14,7 @@ namespace Arcane {
 	};
 }
 
+// only the blocks shown on the minimap have it
+COMPONENT_STORAGE(Arcane::ThumbnailCom, STORAGE_SPARSE)
+
 #endif
@@ -2,6 +2,7 @@
 #define _COMPONENT_NODE_H_
 
 #include "../tool/rpocojson.hpp"
+#include "../entity_ext/component.h"
 
 namespace Arcane {
 	struct NodeCom {
@@ -2,6 +2,7 @@
 #define _COMPONENT_SPRITE_H_
 
 #include "../tool/rpocojson.hpp"
+#include "../entity_ext/component.h"
 
 
 namespace Arcane {
@@ -18,4 +19,7 @@ namespace Arcane {
     };
 }
 
+// only a few blocks are animated
+COMPONENT_STORAGE(Arcane::AnimeCom, STORAGE_SPARSE)
+
 #endif
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2016-2018 tan yukun  <tyk.163@163.com>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: tan yukun <tyk.163@163.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cassert>
+#include <cstdint>
+#include <algorithm>
+#include <vector>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define ECS_BITMAP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define ECS_BITMAP_SSE2
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace ECS {
+	// the index of the lowest bit set, word must not be 0
+	inline unsigned countTrailingZeros(uint64_t word) {
+#if defined(_MSC_VER) && defined(_M_X64)
+		unsigned long bit;
+		_BitScanForward64(&bit, word);
+		return unsigned(bit);
+#elif defined(_MSC_VER)
+		unsigned long bit;
+		if (_BitScanForward(&bit, uint32_t(word)))
+			return unsigned(bit);
+		_BitScanForward(&bit, uint32_t(word >> 32));
+		return unsigned(bit) + 32;
+#else
+		return unsigned(__builtin_ctzll(word));
+#endif
+	}
+
+	/**
+	* A growable set of bits, 64 to a word, the words beyond the end are zero.
+	*/
+	class Bitmap {
+	public:
+		static const std::size_t WORD_BITS = 64;
+
+		bool test(std::size_t n) const {
+			std::size_t word = n / WORD_BITS;
+			return word < words_.size() && (words_[word] >> (n % WORD_BITS) & 1);
+		}
+
+		void set(std::size_t n) {
+			std::size_t word = n / WORD_BITS;
+			if (word >= words_.size())
+				words_.resize(word + 1, 0);
+			words_[word] |= uint64_t(1) << (n % WORD_BITS);
+		}
+
+		void reset(std::size_t n) {
+			std::size_t word = n / WORD_BITS;
+			if (word < words_.size())
+				words_[word] &= ~(uint64_t(1) << (n % WORD_BITS));
+		}
+
+		// drop the bits from n on, and release the words
+		void shrink(std::size_t n) {
+			std::size_t words = (n + WORD_BITS - 1) / WORD_BITS;
+			if (words < words_.size())
+				words_.resize(words);
+			if (words == words_.size() && words && n % WORD_BITS)
+				words_[words - 1] &= (uint64_t(1) << (n % WORD_BITS)) - 1;
+			words_.shrink_to_fit();
+		}
+
+		void clear() {
+			words_.clear();
+		}
+
+		std::size_t words() const { return words_.size(); }
+		const uint64_t *data() const { return words_.data(); }
+
+	private:
+		std::vector<uint64_t> words_;
+	};
+
+	// out[i] = the and of the words first + i of all the bitmaps, less the bits of
+	// the excluded ones, for i < count. the bitmaps must hold first + count words,
+	// the excluded ones may be shorter
+	inline void intersectWords(const Bitmap *const *bitmaps, std::size_t n,
+		const Bitmap *const *excluded, std::size_t m,
+		std::size_t first, std::size_t count, uint64_t *out) {
+		std::size_t i = 0;
+#if defined(ECS_BITMAP_AVX2)
+		for (; i + 4 <= count; i += 4) {
+			__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bitmaps[0]->data() + first + i));
+			for (std::size_t k = 1; k < n; k++)
+				acc = _mm256_and_si256(acc, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bitmaps[k]->data() + first + i)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), acc);
+		}
+#elif defined(ECS_BITMAP_SSE2)
+		for (; i + 2 <= count; i += 2) {
+			__m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bitmaps[0]->data() + first + i));
+			for (std::size_t k = 1; k < n; k++)
+				acc = _mm_and_si128(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(bitmaps[k]->data() + first + i)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), acc);
+		}
+#endif
+		for (; i < count; i++) {
+			uint64_t acc = bitmaps[0]->data()[first + i];
+			for (std::size_t k = 1; k < n; k++)
+				acc &= bitmaps[k]->data()[first + i];
+			out[i] = acc;
+		}
+
+		for (std::size_t k = 0; k < m; k++) {
+			std::size_t words = excluded[k]->words();
+			if (words <= first)
+				continue;
+			const uint64_t *other = excluded[k]->data() + first;
+			std::size_t end = std::min(count, words - first);
+			i = 0;
+#if defined(ECS_BITMAP_AVX2)
+			for (; i + 4 <= end; i += 4) {
+				__m256i acc = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(out + i));
+				acc = _mm256_andnot_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(other + i)), acc);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), acc);
+			}
+#elif defined(ECS_BITMAP_SSE2)
+			for (; i + 2 <= end; i += 2) {
+				__m128i acc = _mm_loadu_si128(reinterpret_cast<const __m128i*>(out + i));
+				acc = _mm_andnot_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(other + i)), acc);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), acc);
+			}
+#endif
+			for (; i < end; i++)
+				out[i] &= ~other[i];
+		}
+	}
+
+	/**
+	* The bits set in all of the bitmaps and in none of the excluded ones, below a
+	* limit, in increasing order.
+	* A block of words is intersected at once, its bits are then taken one by one
+	* with ctz, the bitmaps may change between the blocks.
+	*/
+	class BitmapScan {
+	public:
+		static const std::size_t BLOCK_WORDS = 16;
+		static const std::size_t END = ~std::size_t(0);
+
+		BitmapScan() {}
+		// @param begin the first bit, at the start of a word
+		BitmapScan(const std::vector<const Bitmap*> &bitmaps, const std::vector<const Bitmap*> &excluded,
+			std::size_t limit, std::size_t begin = 0)
+			: bitmaps_(bitmaps), excluded_(excluded), limit_(limit), first_(begin / Bitmap::WORD_BITS) {
+			assert(begin % Bitmap::WORD_BITS == 0);
+		}
+
+		// the next bit, END after the last one
+		std::size_t next() {
+			while (!word_) {
+				if (!load())
+					return END;
+			}
+			std::size_t bit = base_ + countTrailingZeros(word_);
+			word_ &= word_ - 1;
+			if (bit >= limit_) {
+				// nothing more to load
+				word_ = 0;
+				cursor_ = count_;
+				limit_ = 0;
+				return END;
+			}
+			return bit;
+		}
+
+	private:
+		bool load() {
+			if (cursor_ == count_) {
+				std::size_t first = first_ + count_;
+				std::size_t words = (limit_ + Bitmap::WORD_BITS - 1) / Bitmap::WORD_BITS;
+				for (const Bitmap *bitmap : bitmaps_)
+					words = std::min(words, bitmap->words());
+				if (bitmaps_.empty() || first >= words)
+					return false;
+				first_ = first;
+				count_ = std::min(std::size_t(BLOCK_WORDS), words - first);
+				cursor_ = 0;
+				intersectWords(bitmaps_.data(), bitmaps_.size(), excluded_.data(), excluded_.size(), first_, count_, block_);
+			}
+			base_ = (first_ + cursor_) * Bitmap::WORD_BITS;
+			word_ = block_[cursor_++];
+			return true;
+		}
+
+		std::vector<const Bitmap*> bitmaps_;
+		std::vector<const Bitmap*> excluded_;
+		std::size_t limit_ = 0;
+		// the words [first_, first_ + count_) intersected
+		uint64_t block_[BLOCK_WORDS] = {};
+		std::size_t first_ = 0;
+		std::size_t count_ = 0;
+		std::size_t cursor_ = 0;
+		uint64_t word_ = 0;
+		std::size_t base_ = 0;
+	};
+}
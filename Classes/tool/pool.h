@@ -12,15 +12,24 @@
 
 #include <cstddef>
 #include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+#include <utility>
+#include <new>
+#include <type_traits>
 #include <vector>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
 
 namespace ECS {
 	class BasePool {
 	public:
-		BasePool(std::size_t element_size, std::size_t chunk_size = 512)
+		// @param chunk_size the count of the elements in a chunk
+		explicit BasePool(std::size_t chunk_size)
 			: chunk_size_(chunk_size), capacity_(0) {
-			assert(chunk_size > element_size);
-			chunk_size_ = chunk_size / element_size;
+			assert(chunk_size > 0);
 		}
 		virtual ~BasePool() {}
 
@@ -28,18 +37,16 @@ namespace ECS {
 		std::size_t capacity() const { return capacity_; }
 
 		// Ensure at least n elements will fit in the pool.
-		inline void expand(std::size_t n) {
+		virtual void expand(std::size_t n) {
 			if (n >= size_) {
-				if (n >= capacity_) reserve(n);
+				if (n >= capacity_) grow(n);
 				size_ = n;
 			}
 		}
 
-		inline void reserve(std::size_t n) {
-			while (capacity_ < n) {
-				create(chunk_size_);
-				capacity_ += chunk_size_;
-			}
+		// Prepare the storage of n elements ahead, for the loading time
+		virtual void reserve(std::size_t n) {
+			grow(n);
 		}
 
 		virtual void *get(std::size_t n) = 0;
@@ -50,48 +57,238 @@ namespace ECS {
 
 		virtual void create(std::size_t count) = 0;
 
+		// the slot n is going to hold a component
+		virtual void *assign(std::size_t n) { return get(n); }
+
+		// the indices held by a packed pool, nullptr if indexed directly
+		virtual const std::vector<uint32_t> *packed() const { return nullptr; }
+
+		// move the component of the slot from to the empty slot to
+		virtual void relocate(std::size_t from, std::size_t to) = 0;
+
+		// drop the slots from n on, they must be empty, and release the memory
+		virtual void shrink(std::size_t n) {}
+
 	protected:
+		BasePool() {}
+
+		inline void grow(std::size_t n) {
+			while (capacity_ < n) {
+				create(chunk_size_);
+				capacity_ += chunk_size_;
+			}
+		}
+
 		std::size_t chunk_size_ = 0;
 		std::size_t size_ = 0;
 		std::size_t capacity_ = 0;
 	};
 
+	static const std::size_t POOL_PAGE_SIZE = 4 * 1024;
+	static const std::size_t POOL_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	inline void *allocatePages(std::size_t bytes, std::size_t page_size) {
+#if defined(_WIN32)
+		void *pages = _aligned_malloc(bytes, page_size);
+#else
+		void *pages = nullptr;
+		if (posix_memalign(&pages, page_size, bytes) != 0)
+			pages = nullptr;
+#endif
+		if (!pages)
+			throw std::bad_alloc();
+		return pages;
+	}
+
+	inline void freePages(void *pages) {
+#if defined(_WIN32)
+		_aligned_free(pages);
+#else
+		free(pages);
+#endif
+	}
+
+	// the shift of the largest power of two not greater than n
+	constexpr std::size_t floorLog2(std::size_t n) {
+		return n <= 1 ? 0 : 1 + floorLog2(n >> 1);
+	}
+
+	/**
+	* the chunk layout of a Pool<T>, all at compile time:
+	* a chunk holds a power of two of the elements, as many as fit in a page,
+	* the components bigger than 1 KB use the 2 MB pages, 
+	* the ones bigger than a page get a chunk of their own.
+	* a chunk takes only the 4 KB pages its elements need, not a whole huge page
+	*/
+	template <typename T>
+	struct PoolLayout {
+		static const std::size_t PAGE_SIZE = sizeof(T) > 1024 ? POOL_HUGE_PAGE_SIZE : POOL_PAGE_SIZE;
+		static const std::size_t CHUNK_SHIFT = floorLog2(PAGE_SIZE / sizeof(T));
+		static const std::size_t CHUNK_SIZE = std::size_t(1) << CHUNK_SHIFT;
+		static const std::size_t CHUNK_MASK = CHUNK_SIZE - 1;
+		static const std::size_t CHUNK_BYTES = (sizeof(T) * CHUNK_SIZE + POOL_PAGE_SIZE - 1) / POOL_PAGE_SIZE * POOL_PAGE_SIZE;
+	};
+
 	/**
 	* Implementation of BasePool that provides type-"safe" deconstruction of
 	* elements in the pool.
+	* The pool is split in pages of raw storage, a page is allocated when one of
+	* its slots is assigned and freed when its last component is destroyed,
+	* so the memory follows the components held, not the indices.
+	* at() is the inline accessor for the callers knowing the type, a shift and a mask.
 	*/
-	template <typename T, std::size_t ChunkSize = 512>
+	template <typename T>
 	class Pool : public BasePool {
 	public:
-		Pool() : BasePool(sizeof(T), ChunkSize) {}
+		typedef PoolLayout<T> Layout;
+
+		Pool() : BasePool(Layout::CHUNK_SIZE) {}
 		virtual ~Pool() {
-			for (auto arr : datas)
-				delete[] arr;
+			for (std::size_t i = 0; i < size_; i++)
+				destroy(i);
+			// the pages reserved and never used are still there
+			for (auto &page : pages_)
+				if (page.data)
+					freePages(page.data);
+		}
+
+		inline T *at(std::size_t n) {
+			assert(n < size_ && pages_[n >> Layout::CHUNK_SHIFT].data);
+			return pages_[n >> Layout::CHUNK_SHIFT].data + (n & Layout::CHUNK_MASK);
+		}
+
+		inline const T *at(std::size_t n) const {
+			assert(n < size_ && pages_[n >> Layout::CHUNK_SHIFT].data);
+			return pages_[n >> Layout::CHUNK_SHIFT].data + (n & Layout::CHUNK_MASK);
 		}
 
 		virtual void *get(std::size_t n) override {
-			assert(n < size_);
-			return &(datas[n / chunk_size_][n % chunk_size_]);
+			return at(n);
 		}
 
 		virtual const void *get(std::size_t n) const override {
-			assert(n < size_);
-			return &(datas[n / chunk_size_][n % chunk_size_]);
+			return at(n);
+		}
+
+		virtual void *assign(std::size_t n) override {
+			Page &page = touch(n);
+			std::size_t slot = n & Layout::CHUNK_MASK;
+			if (!page.alive[slot]) {
+				new (page.data + slot) T();
+				page.alive[slot] = true;
+				++page.count;
+			}
+			return page.data + slot;
+		}
+
+		// construct the component in the slot, or assign an existing one
+		template <typename ... Args>
+		T *emplace(std::size_t n, Args && ... args) {
+			Page &page = touch(n);
+			std::size_t slot = n & Layout::CHUNK_MASK;
+			if (page.alive[slot]) {
+				page.data[slot] = T(std::forward<Args>(args) ...);
+			}
+			else {
+				new (page.data + slot) T(std::forward<Args>(args) ...);
+				page.alive[slot] = true;
+				++page.count;
+			}
+			return page.data + slot;
+		}
+
+		virtual void relocate(std::size_t from, std::size_t to) override {
+			Page &page = touch(to);
+			std::size_t slot = to & Layout::CHUNK_MASK;
+			assert(!page.alive[slot]);
+			new (page.data + slot) T(std::move(*at(from)));
+			page.alive[slot] = true;
+			++page.count;
+			destroy(from);
+		}
+
+		virtual void shrink(std::size_t n) override {
+			std::size_t count = (n + Layout::CHUNK_MASK) >> Layout::CHUNK_SHIFT;
+			size_ = std::min(size_, n);
+			if (count >= pages_.size())
+				return;
+			// the pages past n hold no component, reserved ones are freed as well
+			for (std::size_t i = count; i < pages_.size(); i++) {
+				assert(pages_[i].count == 0);
+				if (pages_[i].data)
+					freePages(pages_[i].data);
+			}
+			pages_.resize(count);
+			pages_.shrink_to_fit();
+			capacity_ = count << Layout::CHUNK_SHIFT;
 		}
 
 		virtual void destroy(std::size_t n) override {
-			assert(n < size_);
-			*(static_cast<T*>(get(n))) = def;
+			if (n >= size_)
+				return;
+			Page &page = pages_[n >> Layout::CHUNK_SHIFT];
+			std::size_t slot = n & Layout::CHUNK_MASK;
+			if (!page.data || !page.alive[slot])
+				return;
+			page.data[slot].~T();
+			page.alive[slot] = false;
+			if (--page.count == 0) {
+				// the page is empty, give it back
+				freePages(page.data);
+				page.data = nullptr;
+				std::vector<bool>().swap(page.alive);
+			}
+		}
+
+		// allocate the pages of the first n slots ahead
+		virtual void reserve(std::size_t n) override {
+			grow(n);
+			for (std::size_t i = 0; i < pages_.size() && (i << Layout::CHUNK_SHIFT) < n; i++) {
+				Page &page = pages_[i];
+				if (!page.data) {
+					page.data = static_cast<T*>(allocatePages(Layout::CHUNK_BYTES, Layout::PAGE_SIZE));
+					page.alive.assign(Layout::CHUNK_SIZE, false);
+				}
+			}
 		}
 
+		// only the page table grows, the pages are allocated on the first assign
 		virtual void create(std::size_t count) override {
-			T *arr = new T[count];
-			datas.push_back(arr);
+			assert(count == Layout::CHUNK_SIZE);
+			pages_.push_back(Page());
+		}
+
+		// the count of the pages allocated
+		std::size_t pages() const {
+			std::size_t count = 0;
+			for (auto &page : pages_)
+				if (page.data)
+					++count;
+			return count;
 		}
 
 	protected:
-		std::vector<T*> datas;
-		T def;
+		struct Page;
+
+		// the page of the slot n, allocated if not yet
+		Page &touch(std::size_t n) {
+			expand(n + 1);
+			Page &page = pages_[n >> Layout::CHUNK_SHIFT];
+			if (!page.data) {
+				page.data = static_cast<T*>(allocatePages(Layout::CHUNK_BYTES, Layout::PAGE_SIZE));
+				page.alive.assign(Layout::CHUNK_SIZE, false);
+			}
+			return page;
+		}
+
+		struct Page {
+			T *data = nullptr;
+			std::size_t count = 0;
+			// the slots holding a constructed component
+			std::vector<bool> alive;
+		};
+
+		std::vector<Page> pages_;
 	};
 
 }  // namespace entityx
@@ -0,0 +1,45 @@
+/*
+ * Copyright (C) 2016-2018 tan yukun  <tyk.163@163.com>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: tan yukun <tyk.163@163.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cassert>
+
+namespace ECS {
+	/**
+	* A view of contiguous elements, it does not own them.
+	*/
+	template <typename T>
+	class Span {
+	public:
+		typedef T value_type;
+		typedef T *iterator;
+
+		Span() : data_(nullptr), size_(0) {}
+		Span(T *data, std::size_t size) : data_(data), size_(size) {}
+
+		T *data() const { return data_; }
+		std::size_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+
+		T &operator [] (std::size_t n) const {
+			assert(n < size_);
+			return data_[n];
+		}
+
+		T *begin() const { return data_; }
+		T *end() const { return data_ + size_; }
+
+	private:
+		T *data_;
+		std::size_t size_;
+	};
+}
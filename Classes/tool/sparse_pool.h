@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2016-2018 tan yukun  <tyk.163@163.com>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: tan yukun <tyk.163@163.com>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include "pool.h"
+
+namespace ECS {
+	/**
+	* Sparse set: the components and their indices are packed in two parallel
+	* arrays, a paged sparse array maps an index to its packed position.
+	* Memory is proportional to the components held, not to the entities.
+	*/
+	template <typename T, std::size_t PageSize = 4096>
+	class SparsePool : public BasePool {
+	public:
+		static const uint32_t INVALID = ~0U;
+
+		SparsePool() {}
+		virtual ~SparsePool() {
+			for (auto page : sparse_)
+				delete[] page;
+		}
+
+		virtual void expand(std::size_t n) override {}
+
+		// room for n components in the packed arrays
+		virtual void reserve(std::size_t n) override {
+			packed_.reserve(n);
+			components_.reserve(n);
+		}
+
+		bool contains(std::size_t n) const {
+			std::size_t page = n / PageSize;
+			return page < sparse_.size() && sparse_[page] && sparse_[page][n % PageSize] != INVALID;
+		}
+
+		inline T *at(std::size_t n) {
+			assert(contains(n));
+			return &components_[sparse_[n / PageSize][n % PageSize]];
+		}
+
+		inline const T *at(std::size_t n) const {
+			assert(contains(n));
+			return &components_[sparse_[n / PageSize][n % PageSize]];
+		}
+
+		virtual void *get(std::size_t n) override {
+			return at(n);
+		}
+
+		virtual const void *get(std::size_t n) const override {
+			return at(n);
+		}
+
+		virtual void *assign(std::size_t n) override {
+			if (contains(n))
+				return get(n);
+			uint32_t &slot = accommodate(n);
+			slot = uint32_t(packed_.size());
+			packed_.push_back(uint32_t(n));
+			components_.push_back(T());
+			return &components_.back();
+		}
+
+		// construct the component at the end, or assign an existing one
+		template <typename ... Args>
+		T *emplace(std::size_t n, Args && ... args) {
+			if (contains(n)) {
+				T *component = at(n);
+				*component = T(std::forward<Args>(args) ...);
+				return component;
+			}
+			uint32_t &slot = accommodate(n);
+			slot = uint32_t(packed_.size());
+			packed_.push_back(uint32_t(n));
+			components_.emplace_back(std::forward<Args>(args) ...);
+			return &components_.back();
+		}
+
+		// swap the last one into the hole, keep the arrays packed
+		virtual void destroy(std::size_t n) override {
+			if (!contains(n))
+				return;
+			uint32_t &slot = sparse_[n / PageSize][n % PageSize];
+			uint32_t last = packed_.back();
+			if (last != n) {
+				components_[slot] = std::move(components_.back());
+				packed_[slot] = last;
+				sparse_[last / PageSize][last % PageSize] = slot;
+			}
+			components_.pop_back();
+			packed_.pop_back();
+			slot = INVALID;
+		}
+
+		virtual void create(std::size_t count) override {}
+
+		// the component stays in place, only its index changes
+		virtual void relocate(std::size_t from, std::size_t to) override {
+			assert(contains(from) && !contains(to));
+			uint32_t &slot = sparse_[from / PageSize][from % PageSize];
+			packed_[slot] = uint32_t(to);
+			accommodate(to) = slot;
+			slot = INVALID;
+		}
+
+		virtual void shrink(std::size_t n) override {
+			std::size_t count = (n + PageSize - 1) / PageSize;
+			for (std::size_t i = count; i < sparse_.size(); i++)
+				delete[] sparse_[i];
+			if (count < sparse_.size())
+				sparse_.resize(count);
+			sparse_.shrink_to_fit();
+			packed_.shrink_to_fit();
+			components_.shrink_to_fit();
+		}
+
+		virtual const std::vector<uint32_t> *packed() const override { return &packed_; }
+
+		// put the components in the order of the indices, the ones of all the components held
+		void arrange(const std::vector<uint32_t> &order) {
+			assert(order.size() == packed_.size());
+			for (std::size_t i = 0; i < order.size(); i++) {
+				uint32_t n = order[i];
+				uint32_t &slot = sparse_[n / PageSize][n % PageSize];
+				if (slot == i)
+					continue;
+				// the one at i takes the place of n
+				uint32_t other = packed_[i];
+				std::swap(components_[i], components_[slot]);
+				packed_[slot] = other;
+				sparse_[other / PageSize][other % PageSize] = slot;
+				packed_[i] = n;
+				slot = uint32_t(i);
+			}
+		}
+
+	private:
+		uint32_t &accommodate(std::size_t n) {
+			std::size_t page = n / PageSize;
+			if (sparse_.size() <= page)
+				sparse_.resize(page + 1, nullptr);
+			if (!sparse_[page]) {
+				sparse_[page] = new uint32_t[PageSize];
+				std::fill(sparse_[page], sparse_[page] + PageSize, INVALID);
+			}
+			return sparse_[page][n % PageSize];
+		}
+
+		std::vector<uint32_t*> sparse_;
+		std::vector<uint32_t> packed_;
+		std::vector<T> components_;
+	};
+
+	template <typename T, std::size_t PageSize>
+	const uint32_t SparsePool<T, PageSize>::INVALID;
+
+}  // namespace ECS
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016-2018 tan yukun  <tyk.163@163.com>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: tan yukun <tyk.163@163.com>
+ */
+
+#include "thread_pool.h"
+#include <algorithm>
+
+namespace ECS {
+	ThreadPool::ThreadPool(std::size_t workers) : m_next(0) {
+		m_threads.reserve(workers);
+		for (std::size_t i = 0; i < workers; i++)
+			m_threads.push_back(std::thread(&ThreadPool::work, this));
+	}
+
+	ThreadPool::~ThreadPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (auto &thread : m_threads)
+			thread.join();
+	}
+
+	void ThreadPool::parallelFor(std::size_t count, std::size_t grain, const Range &fn) {
+		if (count == 0)
+			return;
+		grain = std::max<std::size_t>(grain, 1);
+		if (m_threads.empty() || count <= grain) {
+			fn(0, count);
+			return;
+		}
+
+		std::lock_guard<std::mutex> loop(m_loop_mutex);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_range = &fn;
+			m_count = count;
+			m_grain = grain;
+			m_next = 0;
+			m_active = m_threads.size();
+			m_generation++;
+		}
+		m_wake.notify_all();
+		run();
+
+		// the workers leave the loop before fn goes away
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this] { return m_active == 0; });
+		m_range = nullptr;
+	}
+
+	ThreadPool &ThreadPool::shared() {
+		static ThreadPool pool(std::max<unsigned>(std::thread::hardware_concurrency(), 1) - 1);
+		return pool;
+	}
+
+	void ThreadPool::work() {
+		uint64_t seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+				if (m_stop)
+					return;
+				seen = m_generation;
+			}
+			run();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_active == 0)
+				m_done.notify_one();
+		}
+	}
+
+	void ThreadPool::run() {
+		for (;;) {
+			std::size_t begin = m_next.fetch_add(m_grain);
+			if (begin >= m_count)
+				return;
+			(*m_range)(begin, std::min(begin + m_grain, m_count));
+		}
+	}
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2016-2018 tan yukun  <tyk.163@163.com>
+ * All rights reserved.
+ *
+ * This software is licensed as described in the file COPYING, which
+ * you should have received as part of this distribution.
+ *
+ * Author: tan yukun <tyk.163@163.com>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ECS {
+	/**
+	* Worker threads sharing the ranges of a loop, the calling thread takes part.
+	* One loop runs at a time, a loop must not start another one of the same pool.
+	*/
+	class ThreadPool {
+	public:
+		// fn(begin, end) for a range of the loop
+		typedef std::function<void(std::size_t begin, std::size_t end)> Range;
+
+		// @param workers the threads besides the calling one
+		explicit ThreadPool(std::size_t workers);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator = (const ThreadPool &) = delete;
+
+		std::size_t workers() const { return m_threads.size(); }
+
+		// fn over [0, count) in ranges of grain, returns when all of them are done
+		void parallelFor(std::size_t count, std::size_t grain, const Range &fn);
+
+		// a worker for each core but the calling one
+		static ThreadPool &shared();
+
+	private:
+		void work();
+
+		// take the ranges until none is left
+		void run();
+
+		std::vector<std::thread> m_threads;
+		// one loop at a time
+		std::mutex m_loop_mutex;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+		bool m_stop = false;
+		uint64_t m_generation = 0;
+		std::size_t m_active = 0;
+		// the loop running
+		const Range *m_range = nullptr;
+		std::size_t m_count = 0;
+		std::size_t m_grain = 1;
+		std::atomic<std::size_t> m_next;
+	};
+}